@@ -0,0 +1,533 @@
+#include "Context.h"
+#include "System.h"
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+using namespace tx;
+
+/// ======================== components and setup ========================
+
+struct Vec3
+{
+    double x = 0., y = 0., z = 0.;
+};
+
+/// a flag that is toggled often, in archetype storage and in sparse set storage
+struct Flag
+{
+    int value = 0;
+};
+struct SparseFlag
+{
+    int value = 0;
+};
+template<>
+struct tx::component_storage<SparseFlag>
+    : std::integral_constant<ComponentStorage, ComponentStorage::SparseSet>
+{
+};
+
+static const ComponentID position("Position");
+static const ComponentID velocity("Velocity");
+static const ComponentID mass("Mass");
+static const ComponentID flag("Flag");
+static const ComponentID sparseFlag("SparseFlag");
+
+/// 1K, 100K and 1M entities
+static void entityCounts(benchmark::internal::Benchmark* b)
+{
+    b->ArgName("entities")->Arg(1000)->Arg(100000)->Arg(1000000)->Unit(benchmark::kMicrosecond);
+}
+
+static std::vector<EntityHandle> createEntities(Context& ctxt, size_t n)
+{
+    std::vector<EntityHandle> handles;
+    handles.reserve(n);
+    ctxt.exec([&handles, n](Context::ModifyingProxy& p) {
+        for (size_t i = 0; i < n; ++i)
+            handles.push_back(p.createEntity());
+    });
+    return handles;
+}
+
+/// n entities with Position, Velocity and Mass
+static std::vector<EntityHandle> createMovingEntities(Context& ctxt, size_t n)
+{
+    std::vector<EntityHandle> handles = createEntities(ctxt, n);
+    ctxt.exec([&handles](Context::ModifyingProxy& p) {
+        for (EntityHandle h : handles)
+        {
+            p.emplaceComponent<Vec3>(h, position);
+            p.emplaceComponent<Vec3>(h, velocity, Vec3{1., 0., 0.});
+            p.emplaceComponent<double>(h, mass, 1.);
+        }
+    });
+    return handles;
+}
+
+static void setItems(benchmark::State& state, size_t perIteration)
+{
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * perIteration));
+}
+
+/// ======================== structural changes ========================
+
+static void BM_CreateEntities(benchmark::State& state)
+{
+    const size_t n = static_cast<size_t>(state.range(0));
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        auto ctxt = std::make_unique<Context>();
+        state.ResumeTiming();
+
+        benchmark::DoNotOptimize(createEntities(*ctxt, n).data());
+
+        state.PauseTiming();
+        ctxt.reset();
+        state.ResumeTiming();
+    }
+    setItems(state, n);
+}
+
+/// adds two components to every entity, each one moves the entity to another archetype
+static void BM_EmplaceComponent(benchmark::State& state)
+{
+    const size_t n = static_cast<size_t>(state.range(0));
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        auto                      ctxt    = std::make_unique<Context>();
+        std::vector<EntityHandle> handles = createEntities(*ctxt, n);
+        state.ResumeTiming();
+
+        ctxt->exec([&handles](Context::ModifyingProxy& p) {
+            for (EntityHandle h : handles)
+            {
+                p.emplaceComponent<Vec3>(h, position);
+                p.emplaceComponent<Vec3>(h, velocity, Vec3{1., 0., 0.});
+            }
+        });
+
+        state.PauseTiming();
+        ctxt.reset();
+        state.ResumeTiming();
+    }
+    setItems(state, 2 * n);
+}
+
+/// adds and removes a flag on every entity with three other components
+template<typename FlagType>
+static void toggleFlag(benchmark::State& state, const ComponentID& cId)
+{
+    const size_t              n = static_cast<size_t>(state.range(0));
+    Context                   ctxt;
+    std::vector<EntityHandle> handles = createMovingEntities(ctxt, n);
+
+    for (auto _ : state)
+    {
+        ctxt.exec([&handles, &cId](Context::ModifyingProxy& p) {
+            for (EntityHandle h : handles)
+                p.emplaceComponent<FlagType>(h, cId);
+            for (EntityHandle h : handles)
+                p.removeComponent(h, cId);
+        });
+    }
+    setItems(state, 2 * n);
+}
+
+static void BM_ToggleFlag(benchmark::State& state) { toggleFlag<Flag>(state, flag); }
+
+static void BM_ToggleSparseFlag(benchmark::State& state)
+{
+    toggleFlag<SparseFlag>(state, sparseFlag);
+}
+
+/// builds standalone entities and hands them over, their components come from resource or malloc
+static void setEntities(benchmark::State& state, bool pooled)
+{
+    const size_t              n = static_cast<size_t>(state.range(0));
+    Context                   ctxt;
+    std::vector<EntityHandle> handles = createEntities(ctxt, n);
+
+    for (auto _ : state)
+    {
+        ctxt.exec([&handles, &ctxt, pooled](Context::ModifyingProxy& p) {
+            for (EntityHandle h : handles)
+            {
+                Entity entity(pooled ? ctxt.memoryResource() : std::pmr::get_default_resource());
+                entity.setComponent(position, Vec3{});
+                entity.setComponent(velocity, Vec3{1., 0., 0.});
+                entity.setComponent(mass, 1.);
+                p.setEntity(h, std::move(entity));
+            }
+        });
+    }
+    setItems(state, n);
+}
+
+static void BM_SetEntity(benchmark::State& state) { setEntities(state, false); }
+
+static void BM_SetEntityPooled(benchmark::State& state) { setEntities(state, true); }
+
+/// how spawnParticles() creates the particles
+enum class Spawn
+{
+    Single,    ///< one by one with emplaceComponent()
+    Prototype, ///< in bulk, copying an entity
+    Prefab     ///< in bulk, from a prefab
+};
+
+/// spawns n particles with Position, Velocity and Mass and removes them again
+static void spawnParticles(benchmark::State& state, Spawn spawn)
+{
+    const size_t n = static_cast<size_t>(state.range(0));
+    Context      ctxt;
+    Entity       particle;
+    particle.setComponent(position, Vec3{});
+    particle.setComponent(velocity, Vec3{1., 0., 0.});
+    particle.setComponent(mass, 1.);
+    const Prefab* prefab = nullptr;
+    if (spawn == Spawn::Prefab) {
+        Entity prototype;
+        prototype.setComponent(position, Vec3{});
+        prototype.setComponent(velocity, Vec3{1., 0., 0.});
+        prototype.setComponent(mass, 1.);
+        ctxt.exec([&prefab, &prototype](Context::ModifyingProxy& p) {
+            prefab = &p.createPrefab(std::move(prototype));
+        });
+    }
+
+    for (auto _ : state)
+    {
+        ctxt.exec([&particle, prefab, n, spawn](Context::ModifyingProxy& p) {
+            if (spawn == Spawn::Prototype) {
+                p.removeEntities(p.createEntities(n, particle));
+                return;
+            }
+            if (spawn == Spawn::Prefab) {
+                p.removeEntities(p.createEntities(n, *prefab));
+                return;
+            }
+            std::vector<EntityHandle> handles;
+            handles.reserve(n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                handles.push_back(p.createEntity());
+                p.emplaceComponent<Vec3>(handles.back(), position);
+                p.emplaceComponent<Vec3>(handles.back(), velocity, Vec3{1., 0., 0.});
+                p.emplaceComponent<double>(handles.back(), mass, 1.);
+            }
+            for (EntityHandle h : handles)
+                p.removeEntity(h);
+        });
+    }
+    setItems(state, n);
+}
+
+static void BM_SpawnParticles(benchmark::State& state) { spawnParticles(state, Spawn::Single); }
+
+static void BM_SpawnParticlesBulk(benchmark::State& state)
+{
+    spawnParticles(state, Spawn::Prototype);
+}
+
+static void BM_SpawnParticlesPrefab(benchmark::State& state)
+{
+    spawnParticles(state, Spawn::Prefab);
+}
+
+/// ======================== access ========================
+
+static void BM_GetComponent(benchmark::State& state)
+{
+    const size_t              n = static_cast<size_t>(state.range(0));
+    Context                   ctxt;
+    std::vector<EntityHandle> handles = createMovingEntities(ctxt, n);
+
+    for (auto _ : state)
+    {
+        ctxt.exec([&handles](Context::ReadOnlyProxy& p) {
+            Vec3 pos;
+            for (EntityHandle h : handles)
+            {
+                p.getComponent(h, position, pos);
+                benchmark::DoNotOptimize(pos);
+            }
+        });
+    }
+    setItems(state, n);
+}
+
+static void BM_Each1(benchmark::State& state)
+{
+    const size_t n = static_cast<size_t>(state.range(0));
+    Context      ctxt;
+    createMovingEntities(ctxt, n);
+
+    for (auto _ : state)
+        ctxt.each(std::array<ComponentID, 1>{{position}},
+                  [](EntityHandle, Vec3& pos) { pos.x += 1.; });
+    setItems(state, n);
+}
+
+/// iterates a flag set on every tenth entity
+template<typename FlagType>
+static void eachFlag(benchmark::State& state, const ComponentID& cId)
+{
+    const size_t              n = static_cast<size_t>(state.range(0));
+    Context                   ctxt;
+    std::vector<EntityHandle> handles = createMovingEntities(ctxt, n);
+    ctxt.exec([&handles, &cId](Context::ModifyingProxy& p) {
+        for (size_t i = 0; i < handles.size(); i += 10)
+            p.emplaceComponent<FlagType>(handles[i], cId);
+    });
+
+    for (auto _ : state)
+        ctxt.each(std::array<ComponentID, 1>{{cId}}, [](EntityHandle, FlagType& f) { ++f.value; });
+    setItems(state, n / 10);
+}
+
+static void BM_EachFlag(benchmark::State& state) { eachFlag<Flag>(state, flag); }
+
+static void BM_EachSparseFlag(benchmark::State& state)
+{
+    eachFlag<SparseFlag>(state, sparseFlag);
+}
+
+static void BM_Each2(benchmark::State& state)
+{
+    const size_t n = static_cast<size_t>(state.range(0));
+    Context      ctxt;
+    createMovingEntities(ctxt, n);
+
+    for (auto _ : state)
+        ctxt.each(std::array<ComponentID, 2>{{position, velocity}},
+                  [](EntityHandle, Vec3& pos, const Vec3& vel) { pos.x += vel.x; });
+    setItems(state, n);
+}
+
+/// the same kernel as BM_Each2, on blocks of components
+static void BM_EachChunk2(benchmark::State& state)
+{
+    const size_t n = static_cast<size_t>(state.range(0));
+    Context      ctxt;
+    createMovingEntities(ctxt, n);
+
+    for (auto _ : state)
+        ctxt.eachChunk(std::array<ComponentID, 2>{{position, velocity}},
+                       [](size_t count, Vec3* pos, const Vec3* vel) {
+                           for (size_t i = 0; i < count; ++i)
+                               pos[i].x += vel[i].x;
+                       });
+    setItems(state, n);
+}
+
+static void BM_Each3(benchmark::State& state)
+{
+    const size_t n = static_cast<size_t>(state.range(0));
+    Context      ctxt;
+    createMovingEntities(ctxt, n);
+
+    for (auto _ : state)
+        ctxt.each(std::array<ComponentID, 3>{{position, velocity, mass}},
+                  [](EntityHandle, Vec3& pos, const Vec3& vel, const double& m) {
+                      pos.x += vel.x / m;
+                  });
+    setItems(state, n);
+}
+
+/// visits the 1% of the positions that were written after a change tick
+static void BM_EachChanged(benchmark::State& state)
+{
+    const size_t              n = static_cast<size_t>(state.range(0));
+    Context                   ctxt;
+    std::vector<EntityHandle> handles = createMovingEntities(ctxt, n);
+    const ChangeTick          since   = ctxt.changeTick();
+    ctxt.exec([&handles](Context::ModifyingProxy& p) {
+        for (size_t i = 0; i < handles.size(); i += 100)
+            p.getComponentWritable<Vec3>(handles[i], position)->x += 1.;
+    });
+
+    for (auto _ : state)
+        ctxt.eachChanged(std::array<ComponentID, 1>{{position}}, since,
+                         [](EntityHandle, const Vec3& pos) { benchmark::DoNotOptimize(pos); });
+    setItems(state, n);
+}
+
+/// ======================== events ========================
+
+/// subscribes to a component and discards its events
+class SubscriberSystem : public System<SubscriberSystem>
+{
+public:
+    explicit SubscriberSystem(ComponentID cId) { declareInterest({cId}); }
+};
+
+/// every iteration modifies one component through a proxy, which emits one event
+static void BM_EmitEvent(benchmark::State& state)
+{
+    Context ctxt;
+    ctxt.emplaceSystem<SubscriberSystem>(position);
+    const EntityHandle entity = createMovingEntities(ctxt, 1).front();
+
+    size_t pending = 0;
+    for (auto _ : state)
+    {
+        ctxt.exec([entity](Context::ModifyingProxy& p) {
+            p.getComponentWritable<Vec3>(entity, position)->x += 1.;
+        });
+
+        // drain the mailbox every now and then so that it does not grow without bounds
+        if (++pending == 4096) {
+            state.PauseTiming();
+            ctxt.updateSystems();
+            pending = 0;
+            state.ResumeTiming();
+        }
+    }
+    setItems(state, 1);
+}
+
+/// ======================== thread pool ========================
+
+/// latency of a submit() until the returned future is ready
+static void BM_SubmitRoundTrip(benchmark::State& state)
+{
+    ThreadPool pool(static_cast<std::uint32_t>(state.range(0)));
+    for (auto _ : state)
+        pool.submit([]() { return 1; }).get();
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+/// ======================== systems ========================
+
+class MoveSystem : public System<MoveSystem>
+{
+public:
+    MoveSystem()
+    {
+        declareReads({velocity});
+        declareWrites({position});
+    }
+
+    bool update(Context& c) override
+    {
+        c.each(std::array<ComponentID, 2>{{position, velocity}},
+               [](EntityHandle, Vec3& pos, const Vec3& vel) { pos.x += vel.x; },
+               Context::Execution::Parallel)
+            .get();
+        return false; // update every tick
+    }
+};
+
+class MassSystem : public System<MassSystem>
+{
+public:
+    MassSystem() { declareReads({mass}); }
+
+    bool update(Context& c) override
+    {
+        double total = 0.;
+        c.each(std::array<ComponentID, 1>{{mass}}, [&total](EntityHandle, const double& m) {
+            total += m;
+        });
+        benchmark::DoNotOptimize(total);
+        return false;
+    }
+};
+
+/// one tick of two independent systems iterating all entities
+static void BM_UpdateSystemsTick(benchmark::State& state)
+{
+    const size_t n = static_cast<size_t>(state.range(0));
+    Context      ctxt;
+    ctxt.emplaceSystem<MoveSystem>();
+    ctxt.emplaceSystem<MassSystem>();
+    createMovingEntities(ctxt, n);
+
+    for (auto _ : state)
+        ctxt.updateSystems();
+    setItems(state, n);
+}
+
+/// ======================== snapshots ========================
+
+static void BM_WriteSnapshot(benchmark::State& state)
+{
+    const size_t n = static_cast<size_t>(state.range(0));
+    Context      ctxt;
+    createMovingEntities(ctxt, n);
+
+    for (auto _ : state)
+    {
+        std::ostringstream out;
+        ctxt.writeSnapshot(out);
+        benchmark::DoNotOptimize(out.tellp());
+    }
+    setItems(state, n);
+}
+
+/// loads a snapshot file of n moving entities into a new context, by reading or by mapping it
+static void loadSnapshot(benchmark::State& state, bool map)
+{
+    const size_t      n = static_cast<size_t>(state.range(0));
+    const std::string path =
+        (std::filesystem::temp_directory_path() / "tx_bench.snapshot").string();
+    {
+        Context ctxt;
+        createMovingEntities(ctxt, n);
+        std::ofstream out(path, std::ios::binary);
+        ctxt.writeSnapshot(out);
+    }
+
+    for (auto _ : state)
+    {
+        Context ctxt;
+        if (map) {
+            ctxt.mapSnapshot(path);
+        }
+        else
+        {
+            std::ifstream in(path, std::ios::binary);
+            ctxt.readSnapshot(in);
+        }
+    }
+    setItems(state, n);
+    std::filesystem::remove(path);
+}
+
+static void BM_ReadSnapshot(benchmark::State& state) { loadSnapshot(state, false); }
+
+static void BM_MapSnapshot(benchmark::State& state) { loadSnapshot(state, true); }
+
+BENCHMARK(BM_CreateEntities)->Apply(entityCounts);
+BENCHMARK(BM_EmplaceComponent)->Apply(entityCounts);
+BENCHMARK(BM_ToggleFlag)->Apply(entityCounts);
+BENCHMARK(BM_ToggleSparseFlag)->Apply(entityCounts);
+BENCHMARK(BM_SetEntity)->Apply(entityCounts);
+BENCHMARK(BM_SetEntityPooled)->Apply(entityCounts);
+BENCHMARK(BM_SpawnParticles)->Apply(entityCounts);
+BENCHMARK(BM_SpawnParticlesBulk)->Apply(entityCounts);
+BENCHMARK(BM_SpawnParticlesPrefab)->Apply(entityCounts);
+BENCHMARK(BM_GetComponent)->Apply(entityCounts);
+BENCHMARK(BM_Each1)->Apply(entityCounts);
+BENCHMARK(BM_EachFlag)->Apply(entityCounts);
+BENCHMARK(BM_EachSparseFlag)->Apply(entityCounts);
+BENCHMARK(BM_Each2)->Apply(entityCounts);
+BENCHMARK(BM_EachChunk2)->Apply(entityCounts);
+BENCHMARK(BM_Each3)->Apply(entityCounts);
+BENCHMARK(BM_EachChanged)->Apply(entityCounts);
+BENCHMARK(BM_EmitEvent);
+BENCHMARK(BM_SubmitRoundTrip)->ArgName("threads")->Arg(1)->Arg(4)->UseRealTime();
+BENCHMARK(BM_UpdateSystemsTick)->Apply(entityCounts);
+BENCHMARK(BM_WriteSnapshot)->Apply(entityCounts);
+BENCHMARK(BM_ReadSnapshot)->Apply(entityCounts);
+BENCHMARK(BM_MapSnapshot)->Apply(entityCounts);
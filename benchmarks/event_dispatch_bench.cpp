@@ -0,0 +1,81 @@
+#include "Context.h"
+#include "System.h"
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+
+using namespace tx;
+
+/// ======================== a system listening to a single component ========================
+
+static const size_t numComponents = 16;
+static const size_t numEntities   = 1024;
+
+static ComponentID componentId(size_t i) { return ComponentID(i + 1); }
+
+/**
+ *  Listens to one component. Either subscribes to it, so that the context routes events through
+ *  its interest index, or only answers isInterested(), which the context has to ask for every
+ *  event.
+ */
+class ListeningSystem : public System<ListeningSystem>
+{
+public:
+    ListeningSystem(ComponentID interest, bool subscribe) : interest_(interest)
+    {
+        if (subscribe) declareInterest({interest});
+        declareReads({interest});
+    }
+
+    bool isInterested(const Context&, EntityHandle, const ComponentID& cId) const override
+    {
+        return cId == interest_;
+    }
+
+    bool update(Context&) override
+    {
+        clearEventQueue();
+        return true;
+    }
+
+private:
+    ComponentID interest_;
+};
+
+/// ======================== benchmarks ========================
+
+/**
+ *  Every iteration, each() writes one component of all entities, which emits one
+ *  COMPONENTCHANGED event per entity. The systems listen to one of 16 components each, so a
+ *  sixteenth of them receives the events.
+ */
+static void dispatchEvents(benchmark::State& state, bool subscribe)
+{
+    Context ctxt;
+    for (int64_t i = 0; i < state.range(0); ++i)
+        ctxt.emplaceSystem<ListeningSystem>(componentId(size_t(i) % numComponents), subscribe);
+    ctxt.exec([](Context::ModifyingProxy& p) {
+        for (size_t i = 0; i < numEntities; ++i)
+            p.emplaceComponent<double>(p.createEntity(), componentId(0), 0.);
+    });
+    ctxt.updateSystems();
+
+    for (auto _ : state)
+    {
+        ctxt.each(std::array<ComponentID, 1>{{componentId(0)}},
+                  [](EntityHandle, double& value) { value += 1.; });
+
+        state.PauseTiming();
+        ctxt.updateSystems(); // drains the mailboxes
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * numEntities));
+}
+
+static void BM_DispatchSubscribed(benchmark::State& state) { dispatchEvents(state, true); }
+
+static void BM_DispatchPolling(benchmark::State& state) { dispatchEvents(state, false); }
+
+BENCHMARK(BM_DispatchSubscribed)->ArgName("systems")->RangeMultiplier(2)->Range(4, 256);
+BENCHMARK(BM_DispatchPolling)->ArgName("systems")->RangeMultiplier(2)->Range(4, 256);
@@ -0,0 +1,144 @@
+#include "ThreadPool.h"
+#include "ThreadSafeWorkQueue.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace tx;
+
+/// ======================== baseline: one mutex + condition variable queue ========================
+
+/**
+ *  The previous ThreadPool design, kept here as a baseline: all workers pop from a single
+ *  ThreadSafeWorkQueue and every submission notifies one worker.
+ */
+class SharedQueueThreadPool
+{
+public:
+    explicit SharedQueueThreadPool(std::uint32_t numThreads)
+    {
+        for (std::uint32_t i = 0u; i < numThreads; ++i)
+            m_threads.emplace_back(&SharedQueueThreadPool::worker, this);
+    }
+
+    ~SharedQueueThreadPool()
+    {
+        m_done = true;
+        m_workQueue.invalidate();
+        for (auto& thread : m_threads)
+            thread.join();
+    }
+
+    template<typename Func>
+    void submit(Func&& func)
+    {
+        m_workQueue.push(std::function<void()>(std::forward<Func>(func)));
+    }
+
+private:
+    void worker()
+    {
+        while (!m_done)
+        {
+            std::function<void()> task;
+            if (m_workQueue.waitPop(task)) task();
+        }
+    }
+
+    std::atomic_bool                           m_done{false};
+    ThreadSafeWorkQueue<std::function<void()>> m_workQueue;
+    std::vector<std::thread>                   m_threads;
+};
+
+/// ======================== adapters so both pools run the same benchmarks ========================
+
+template<typename Func>
+void post(ThreadPool& pool, Func&& func)
+{
+    pool.post(std::forward<Func>(func));
+}
+
+template<typename Func>
+void post(SharedQueueThreadPool& pool, Func&& func)
+{
+    pool.submit(std::forward<Func>(func));
+}
+
+/// a tiny amount of work so that the benchmarks measure scheduling overhead
+inline void smallWork(std::atomic<size_t>& counter)
+{
+    size_t x = 0;
+    for (int i = 0; i < 64; ++i)
+        benchmark::DoNotOptimize(x += static_cast<size_t>(i));
+    counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void waitFor(const std::atomic<size_t>& counter, size_t n)
+{
+    while (counter.load(std::memory_order_acquire) < n)
+        std::this_thread::yield();
+}
+
+static const size_t tasksPerIteration = 10000;
+
+/// ======================== benchmarks ========================
+
+/**
+ *  All tasks are submitted from the benchmark thread, i.e. from outside the pool.
+ */
+template<typename Pool>
+void BM_ExternalSubmit(benchmark::State& state)
+{
+    Pool pool(static_cast<std::uint32_t>(state.range(0)));
+    for (auto _ : state)
+    {
+        std::atomic<size_t> counter{0};
+        for (size_t i = 0; i < tasksPerIteration; ++i)
+            post(pool, [&counter]() { smallWork(counter); });
+        waitFor(counter, tasksPerIteration);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * tasksPerIteration));
+}
+
+/**
+ *  A few root tasks each spawn many fine-grained children from inside the pool, which is the
+ *  pattern of a chunked parallel each().
+ */
+template<typename Pool>
+void BM_NestedSubmit(benchmark::State& state)
+{
+    const size_t roots           = 16;
+    const size_t childrenPerRoot = tasksPerIteration / roots;
+
+    Pool pool(static_cast<std::uint32_t>(state.range(0)));
+    for (auto _ : state)
+    {
+        std::atomic<size_t> counter{0};
+        for (size_t r = 0; r < roots; ++r)
+        {
+            post(pool, [&pool, &counter, childrenPerRoot]() {
+                for (size_t i = 0; i < childrenPerRoot; ++i)
+                    post(pool, [&counter]() { smallWork(counter); });
+            });
+        }
+        waitFor(counter, roots * childrenPerRoot);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * tasksPerIteration));
+}
+
+static void threadCounts(benchmark::internal::Benchmark* b)
+{
+    const int maxThreads = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+    for (int n = 1; n <= maxThreads; ++n)
+        b->Arg(n);
+    b->ArgName("threads")->UseRealTime();
+}
+
+BENCHMARK_TEMPLATE(BM_ExternalSubmit, SharedQueueThreadPool)->Apply(threadCounts);
+BENCHMARK_TEMPLATE(BM_ExternalSubmit, ThreadPool)->Apply(threadCounts);
+BENCHMARK_TEMPLATE(BM_NestedSubmit, SharedQueueThreadPool)->Apply(threadCounts);
+BENCHMARK_TEMPLATE(BM_NestedSubmit, ThreadPool)->Apply(threadCounts);
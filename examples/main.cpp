@@ -79,14 +79,17 @@ class DrawingSystem : public AspectSpecificSystem<DrawAspect>
 {
 public:
     DrawingSystem()
-        : AspectSpecificSystem<DrawAspect>(std::array<ComponentID, 2>{"Position", "Mesh"}){};
+        : AspectSpecificSystem<DrawAspect>(std::array<ComponentID, 2>{"Position", "Mesh"})
+    {
+        declareReads({"Position", "Mesh"});
+    };
 
     bool update(Context& c) override
     {
         std::cout << "Drawing system update(): " << std::endl;
 
         processEvents([](const Event& e) {
-            std::cout << "\t\t\tDrawing System got an event about " << e.eId << std::endl;
+            std::cout << "\t\t\tDrawing System got an event about " << e.entity << std::endl;
         });
 
         c.each(std::array<ComponentID, 2>{{"Position", "Mesh"}},
@@ -103,12 +106,18 @@ public:
 class SimulationSystem : public System<SimulationSystem>
 {
 public:
+    SimulationSystem()
+    {
+        declareReads({"Velocity", "gravity"});
+        declareWrites({"Position"});
+    }
+
     bool update(Context& c) override
     {
         std::cout << "Simulation System update(): " << std::endl;
 
         processEvents([](const Event& e) {
-            std::cout << "\t\t\tSimulation System got an event about " << e.eId << std::endl;
+            std::cout << "\t\t\tSimulation System got an event about " << e.entity << std::endl;
         });
 
         Vec3 g;
@@ -122,8 +131,8 @@ public:
                    pos.z += v.z;
                    std::cout << "\tMoving " << id << " to " << pos.x << " " << pos.y << " " << pos.z
                              << std::endl;
-               })
-            .detach(); // don't care when it actually finishes
+               },
+               Context::Execution::Parallel); // the temporary future waits for all chunks
         return false;
     }
 };
@@ -131,15 +140,17 @@ public:
 class UpdaterSystem : public System<UpdaterSystem>
 {
 public:
+    UpdaterSystem() { declareReads({}); } // only looks at entity IDs, runs alongside everything
+
     bool update(Context& c) override
     {
         std::cout << "Updater update(): " << std::endl;
 
         processEvents([](const Event& e) {
-            std::cout << "\t\t\tUpdater System got an event about " << e.eId << std::endl;
+            std::cout << "\t\t\tUpdater System got an event about " << e.entity << std::endl;
         });
 
-        c.each([](const EntityID& id, Entity& /*e*/) {
+        c.each([](const EntityID& id, const EntityView& /*e*/) {
              std::cout << "\tUpdating " << id << std::endl;
          })
             .detach(); // don't care when it actually finishes
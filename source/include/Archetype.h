@@ -0,0 +1,471 @@
+#pragma once
+
+/**
+ *	\file Archetype.h
+ *	Columnar storage for entities inside the context. All entities that share the same set of
+ *	components (the archetype) live in one Archetype, which stores every component in its own
+ *	contiguous array (one "column" per component, one "row" per entity).
+ */
+
+#include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Component.h"
+#include "ComponentMask.h"
+#include "EntityHandle.h"
+#include "Identifier.h"
+#include "IdentifierMap.h"
+
+namespace tx
+{
+
+/**
+ *  Type-erased base class for a single component column of an archetype.
+ *
+ *  Virtual dispatch is only used for structural changes (adding, moving and removing rows),
+ *  typed access goes through ComponentColumn<C> directly.
+ */
+class ComponentColumnBase
+{
+public:
+    ComponentColumnBase(ComponentTypeID typeId, std::pmr::memory_resource* resource)
+        : ticks_(resource), typeId_(typeId)
+    {
+    }
+    virtual ~ComponentColumnBase(){};
+
+    /// identifies the type of the stored components, matches ComponentBase::typeId()
+    ComponentTypeID typeId() const noexcept { return typeId_; }
+
+    /// the memory resource the rows are allocated from
+    std::pmr::memory_resource* resource() const noexcept
+    {
+        return ticks_.get_allocator().resource();
+    }
+
+    /// human readable name of the stored type, for debugging only
+    const char* typeName() const { return componentTypeInfo(typeId_).name; }
+
+    /// number of stored rows
+    virtual size_t size() const noexcept = 0;
+
+    /// the change tick of every row, see Context::changeTick()
+    ChangeTick* ticks() noexcept { return ticks_.data(); }
+
+    const ChangeTick* ticks() const noexcept { return ticks_.data(); }
+
+    /// records that the component in row was written at the given tick
+    void markChanged(size_t row, ChangeTick tick) noexcept { ticks_[row] = tick; }
+
+    /// creates an empty column storing the same type, allocating from the same resource
+    virtual std::unique_ptr<ComponentColumnBase> cloneEmpty() const = 0;
+
+    /// appends the value of row srcRow of src, which has to store the same type, by moving it.
+    /// The change tick moves along with the value.
+    virtual void moveAppendFrom(ComponentColumnBase& src, size_t srcRow) = 0;
+
+    /// appends the value wrapped in a standalone component, which has to store the same type
+    virtual void moveAppendFrom(ComponentBase& component, ChangeTick tick) = 0;
+
+    /// appends n copies of the value wrapped in a standalone component, which has to store the
+    /// same, copyable type
+    virtual void appendCopies(const ComponentBase& prototype, size_t n, ChangeTick tick) = 0;
+
+    /// appends n copies of the value in row srcRow of src, which has to store the same, copyable
+    /// type
+    virtual void appendCopies(const ComponentColumnBase& src, size_t srcRow, size_t n,
+                              ChangeTick tick) = 0;
+
+    /// removes a row by moving the last row into its place
+    virtual void swapRemove(size_t row) = 0;
+
+    /// reserves storage for at least n rows
+    virtual void reserve(size_t n) = 0;
+
+    /// writes the values of all rows to a snapshot, encoded as the type's SnapshotEncoding
+    virtual void writeValues(std::ostream& out) const = 0;
+
+    /// appends n values written by writeValues(), written at the given tick
+    virtual void readValues(std::istream& in, size_t n, ChangeTick tick) = 0;
+
+    /**
+     *  Uses n values written by writeValues() that are in memory as the storage of this empty
+     *  column, without copying them. mapping keeps the memory alive as long as the column uses
+     *  it, writes go to the memory directly. Only possible for trivially copyable types.
+     *  \return false if the values were not adopted and have to be read
+     */
+    virtual bool adoptValues(void* values, size_t n, std::shared_ptr<void> mapping,
+                             ChangeTick tick) = 0;
+
+protected:
+    std::pmr::vector<ChangeTick> ticks_; ///< kept in sync with the values by the derived column
+
+private:
+    ComponentTypeID typeId_;
+};
+
+/**
+ *  Contiguous storage for all components of type C in an archetype.
+ *
+ *  The values are either owned, or adopted from a memory mapped snapshot, see adoptValues().
+ *  Adopted values are written and removed in place. The column copies them into owned storage
+ *  as soon as it has to grow.
+ */
+template<typename C>
+class ComponentColumn : public ComponentColumnBase
+{
+public:
+    static_assert(std::is_move_constructible<C>::value && std::is_move_assignable<C>::value,
+                  "Component Data Class must be move constructible and move assignable to be "
+                  "stored in the context!");
+
+    explicit ComponentColumn(
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : ComponentColumnBase(componentTypeId<C>(), resource), values_(resource)
+    {
+    }
+
+    size_t size() const noexcept override
+    {
+        return mapped_ != nullptr ? mappedSize_ : values_.size();
+    }
+
+    std::unique_ptr<ComponentColumnBase> cloneEmpty() const override
+    {
+        return std::make_unique<ComponentColumn<C>>(resource());
+    }
+
+    void moveAppendFrom(ComponentColumnBase& src, size_t srcRow) override
+    {
+        auto& column = static_cast<ComponentColumn<C>&>(src);
+        if (mapped_ != nullptr) own(size() + 1);
+        values_.push_back(std::move(column[srcRow]));
+        ticks_.push_back(column.ticks_[srcRow]);
+    }
+
+    void moveAppendFrom(ComponentBase& component, ChangeTick tick) override
+    {
+        if (mapped_ != nullptr) own(size() + 1);
+        values_.push_back(std::move(*static_cast<Component<C>&>(component)));
+        ticks_.push_back(tick);
+    }
+
+    void appendCopies(const ComponentBase& prototype, size_t n, ChangeTick tick) override
+    {
+        if constexpr (std::is_copy_constructible<C>::value) {
+            if (mapped_ != nullptr) own(size() + n);
+            values_.insert(values_.end(), n, *static_cast<const Component<C>&>(prototype));
+            ticks_.insert(ticks_.end(), n, tick);
+        }
+    }
+
+    void appendCopies(const ComponentColumnBase& src, size_t srcRow, size_t n,
+                      ChangeTick tick) override
+    {
+        if constexpr (std::is_copy_constructible<C>::value) {
+            if (mapped_ != nullptr) own(size() + n);
+            // a plain fill for trivially copyable types, no per row constructor calls
+            values_.insert(values_.end(), n, static_cast<const ComponentColumn<C>&>(src)[srcRow]);
+            ticks_.insert(ticks_.end(), n, tick);
+        }
+    }
+
+    void swapRemove(size_t row) override
+    {
+        if (mapped_ != nullptr) {
+            // shrinking does not need new storage
+            mapped_[row] = mapped_[--mappedSize_];
+            ticks_[row]  = ticks_.back();
+            ticks_.pop_back();
+            return;
+        }
+        if (row + 1 != values_.size()) {
+            values_[row] = std::move(values_.back());
+            ticks_[row]  = ticks_.back();
+        }
+        values_.pop_back();
+        ticks_.pop_back();
+    }
+
+    void reserve(size_t n) override
+    {
+        if (mapped_ != nullptr) {
+            if (n > mappedSize_) own(n);
+            return;
+        }
+        values_.reserve(n);
+        ticks_.reserve(n);
+    }
+
+    void writeValues(std::ostream& out) const override
+    {
+        detail::writeComponents(out, data(), size());
+    }
+
+    void readValues(std::istream& in, size_t n, ChangeTick tick) override
+    {
+        if (mapped_ != nullptr) own(size() + n);
+        detail::readComponents<C>(in, values_, n);
+        ticks_.insert(ticks_.end(), values_.size() - ticks_.size(), tick);
+    }
+
+    bool adoptValues(void* values, size_t n, std::shared_ptr<void> mapping,
+                     ChangeTick tick) override
+    {
+        if constexpr (snapshot_encoding_v<C> == SnapshotEncoding::Bytes) {
+            if (size() > 0 || reinterpret_cast<uintptr_t>(values) % alignof(C) != 0) return false;
+            mapped_     = static_cast<C*>(values);
+            mappedSize_ = n;
+            mapping_    = std::move(mapping);
+            ticks_.assign(n, tick);
+            return true;
+        }
+        return false;
+    }
+
+    /// appends a value constructed from args, written at the given tick
+    template<typename... Args>
+    void emplace_back(ChangeTick tick, Args&&... args)
+    {
+        if (mapped_ != nullptr) own(size() + 1);
+        values_.emplace_back(std::forward<Args>(args)...);
+        ticks_.push_back(tick);
+    }
+
+    C& operator[](size_t row) { return data()[row]; }
+
+    const C& operator[](size_t row) const { return data()[row]; }
+
+    C* data() noexcept { return mapped_ != nullptr ? mapped_ : values_.data(); }
+
+    const C* data() const noexcept { return mapped_ != nullptr ? mapped_ : values_.data(); }
+
+private:
+    /// copies adopted values into owned storage with room for n values, and releases the mapping
+    void own(size_t n)
+    {
+        values_.reserve(std::max(n, mappedSize_));
+        values_.assign(mapped_, mapped_ + mappedSize_);
+        ticks_.reserve(values_.capacity());
+        mapped_     = nullptr;
+        mappedSize_ = 0;
+        mapping_.reset();
+    }
+
+    std::pmr::vector<C>   values_;
+    C*                    mapped_     = nullptr; ///< adopted values, see adoptValues()
+    size_t                mappedSize_ = 0;
+    std::shared_ptr<void> mapping_; ///< keeps the adopted values alive
+};
+
+/**
+ *  Stores all entities that have exactly the same set of components.
+ *
+ *  The signature is the list of (ComponentID, ComponentTypeID) pairs, sorted by ComponentID.
+ *  Columns are stored in the same order as the signature.
+ */
+class Archetype
+{
+public:
+    using Signature = std::vector<std::pair<ComponentID, ComponentTypeID>>;
+
+    /// a signature as integers, the interned index of every ID next to its type, see key()
+    using Key = std::vector<uint64_t>;
+
+    /// the entry of a key for a component ID and type
+    static uint64_t keyEntry(const ComponentID& cId, ComponentTypeID typeId)
+    {
+        return uint64_t(identifierIndex(cId)) << 32 | typeId;
+    }
+
+    /// the key of a signature, archetypes and queries are looked up by it
+    static Key key(const Signature& signature)
+    {
+        Key key;
+        key.reserve(signature.size());
+        for (const auto& entry : signature)
+            key.push_back(keyEntry(entry.first, entry.second));
+        return key;
+    }
+
+    /**
+     *  Creates an archetype for the given signature. makeColumn(entry) is called to create the
+     *  (empty) column for every entry of the signature. The entity handles are allocated from
+     *  resource, which should be the resource of the columns.
+     */
+    template<typename ColumnFactory>
+    Archetype(Signature signature, ColumnFactory makeColumn,
+              std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : signature_(std::move(signature)), entities_(resource)
+    {
+        columns_.reserve(signature_.size());
+        for (size_t i = 0; i < signature_.size(); ++i)
+        {
+            columns_.emplace_back(makeColumn(signature_[i]));
+            mask_.set(componentIndex(signature_[i].first, signature_[i].second));
+            const IdentifierIndex index = identifierIndex(signature_[i].first);
+            if (index >= columnIndices_.size()) columnIndices_.resize(index + 1, -1);
+            columnIndices_[index] = static_cast<int>(i);
+        }
+    }
+
+    Archetype(const Archetype&) = delete;
+    Archetype& operator=(const Archetype&) = delete;
+
+    const Signature& signature() const noexcept { return signature_; }
+
+    /// the components of the signature as a bitset, see Aspect::checkAspect()
+    const ComponentMask& mask() const noexcept { return mask_; }
+
+    /// number of entities stored
+    size_t size() const noexcept { return entities_.size(); }
+
+    /// handles of all stored entities, indexed by row
+    const std::pmr::vector<EntityHandle>& entities() const noexcept { return entities_; }
+
+    /// returns the index of the column for the given component, or -1 if it does not exist
+    int columnIndex(const ComponentID& cId) const noexcept
+    {
+        IdentifierIndex index;
+        if (!findIdentifierIndex(cId, index) || index >= columnIndices_.size()) return -1;
+        return columnIndices_[index];
+    }
+
+    /// checks whether the archetype has a component with the given ID and type C
+    template<typename C>
+    bool hasComponent(const ComponentID& cId) const noexcept
+    {
+        int idx = columnIndex(cId);
+        return idx >= 0 && signature_[idx].second == componentTypeId<component_value_t<C>>();
+    }
+
+    ComponentColumnBase& column(size_t idx) noexcept { return *columns_[idx]; }
+
+    const ComponentColumnBase& column(size_t idx) const noexcept { return *columns_[idx]; }
+
+    /// typed access to a column. The caller is responsible for checking the type.
+    template<typename C>
+    ComponentColumn<C>& column(size_t idx) noexcept
+    {
+        return static_cast<ComponentColumn<C>&>(*columns_[idx]);
+    }
+
+    template<typename C>
+    const ComponentColumn<C>& column(size_t idx) const noexcept
+    {
+        return static_cast<const ComponentColumn<C>&>(*columns_[idx]);
+    }
+
+    /**
+     *  Appends a row for the entity. The caller has to append exactly one value to every column
+     *  afterwards. \return the row of the new entity
+     */
+    size_t appendEntity(EntityHandle entity)
+    {
+        entities_.push_back(entity);
+        return entities_.size() - 1;
+    }
+
+    /// appends rows for n entities at once, like appendEntity(). \return the row of the first
+    size_t appendEntities(const EntityHandle* entities, size_t n)
+    {
+        entities_.insert(entities_.end(), entities, entities + n);
+        return entities_.size() - n;
+    }
+
+    /**
+     *  Removes a row by moving the last row into its place.
+     *  \return whether another entity was moved into row
+     */
+    bool swapRemove(size_t row)
+    {
+        for (auto& c : columns_)
+            c->swapRemove(row);
+        bool moved = row + 1 != entities_.size();
+        if (moved) entities_[row] = entities_.back();
+        entities_.pop_back();
+        return moved;
+    }
+
+    void reserve(size_t n)
+    {
+        entities_.reserve(n);
+        for (auto& c : columns_)
+            c->reserve(n);
+    }
+
+private:
+    Signature                                         signature_;
+    ComponentMask                                     mask_; ///< see mask()
+    std::vector<int>                                  columnIndices_; ///< see columnIndex()
+    std::vector<std::unique_ptr<ComponentColumnBase>> columns_;
+    std::pmr::vector<EntityHandle>                    entities_;
+};
+
+/**
+ *  Lightweight, non-owning view of an entity stored in the context.
+ *  Only valid until the next structural change (adding/removing components or entities).
+ */
+class EntityView
+{
+public:
+    EntityView() = default;
+    EntityView(const Archetype* archetype, size_t row) : archetype_(archetype), row_(row) {}
+
+    /// whether the view refers to an existing entity
+    bool isValid() const noexcept { return archetype_ != nullptr; }
+
+    /// handle of the viewed entity, or the null handle if the view is invalid
+    EntityHandle handle() const noexcept
+    {
+        return archetype_ != nullptr ? archetype_->entities()[row_] : EntityHandle();
+    }
+
+    template<typename C>
+    bool hasComponent(const ComponentID& id) const noexcept
+    {
+        return archetype_ != nullptr && archetype_->hasComponent<C>(id);
+    }
+
+    /// typed access to a component. The caller is responsible for checking hasComponent<C>() first.
+    template<typename C>
+    const C& getComponent(const ComponentID& id) const noexcept
+    {
+        return archetype_->column<C>(static_cast<size_t>(archetype_->columnIndex(id)))[row_];
+    }
+
+    std::string toString() const
+    {
+        std::stringstream sstr;
+        sstr << "Entity [";
+        if (archetype_ != nullptr) {
+            const auto& signature = archetype_->signature();
+            for (size_t i = 0; i < signature.size(); ++i)
+                sstr << signature[i].first.name() << ": " << archetype_->column(i).typeName()
+                     << "|";
+        }
+        sstr << " ]";
+        return sstr.str();
+    }
+
+private:
+    const Archetype* archetype_ = nullptr;
+    size_t           row_       = 0;
+};
+
+namespace detail
+{
+template<typename C>
+std::unique_ptr<ComponentColumnBase> makeColumn(std::pmr::memory_resource* resource)
+{
+    return std::make_unique<ComponentColumn<C>>(resource);
+}
+} // namespace detail
+
+} // namespace tx
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "ComponentMask.h"
 #include "Entity.h"
 #include "Identifier.h"
 
@@ -9,6 +10,8 @@
 namespace tx
 {
 
+class Archetype;
+
 /**
  *  Aspect class defines an "interface" that an entity can be checked against, which defines
  *  a collection of ComponentIDs and associated types.
@@ -22,15 +25,26 @@ public:
     static const size_t nCmp = sizeof...(ComponentTypes);
     using IDs_type           = std::array<ComponentID, nCmp>;
 
-    Aspect(const IDs_type& ids) noexcept : ids_{ ids } {}
-    Aspect(IDs_type&& ids) noexcept : ids_{std::move(ids)} {}
+    Aspect(const IDs_type& ids) : ids_{ids}, mask_(makeMask(ids_)) {}
+    Aspect(IDs_type&& ids) : ids_{std::move(ids)}, mask_(makeMask(ids_)) {}
+
+    /**
+     *  Checks whether an archetype of the context has all components of the aspect, by
+     *  comparing their masks.
+     */
+    bool checkAspect(const Archetype& archetype) const noexcept;
 
-    bool checkAspect(const Entity& entity) const noexcept
+    /**
+     *  Checks whether an entity has all components of the aspect. EntityType can be an Entity
+     *  or an EntityView.
+     */
+    template<typename EntityType>
+    bool checkAspect(const EntityType& entity) const noexcept
     {
         // TODO review this, might be unsafe cause of this funny idx++ which is unsequenced. Replace
         // with "swallow" pattern
         size_t idx              = 0;
-        bool   componentFlags[] = {entity.hasComponent<ComponentTypes>(ids_[idx++])...};
+        bool   componentFlags[] = {entity.template hasComponent<ComponentTypes>(ids_[idx++])...};
         for (auto flag : componentFlags)
             if (!flag) return false;
         return true;
@@ -56,7 +70,15 @@ public:
         return false;
     }
 
+    /// the components of the aspect as a bitset
+    const ComponentMask& mask() const noexcept { return mask_; }
+
     const IDs_type ids_;
+
+private:
+    static ComponentMask makeMask(const IDs_type& ids);
+
+    ComponentMask mask_;
 };
 
 // TODO this class is not yet implemented!
@@ -78,6 +100,23 @@ private:
 namespace tx
 {
 
+template<class... ComponentTypes>
+bool Aspect<ComponentTypes...>::checkAspect(const Archetype& archetype) const noexcept
+{
+    return archetype.mask().contains(mask_);
+}
+
+template<class... ComponentTypes>
+ComponentMask Aspect<ComponentTypes...>::makeMask(const IDs_type& ids)
+{
+    const std::array<ComponentTypeID, nCmp> types{
+        {componentTypeId<component_value_t<ComponentTypes>>()...}};
+    ComponentMask mask;
+    for (size_t i = 0; i < nCmp; ++i)
+        mask.set(componentIndex(ids[i], types[i]));
+    return mask;
+}
+
 // template<class... ComponentTypes>
 // AspectInstance<ComponentTypes...> make_aspect_instance(std::pair<ComponentID,
 // std::add_pointer<ComponentTypes>::type>&&... args)
@@ -1,19 +1,240 @@
 #pragma once
 
-#include <typeinfo>
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+
+#include "ComponentMask.h"
+#include "Identifier.h"
+#include "IdentifierMap.h"
+#include "Snapshot.h"
 
 namespace tx
 {
 
-// polymorphic base class for all components
+class ComponentColumnBase;
+class SparsePoolBase;
+template<typename WrappedClass>
+class Component;
+
+/// the plain component type for a functor argument, i.e. without reference and const qualifiers
+template<typename C>
+using component_value_t = std::remove_cv_t<std::remove_reference_t<C>>;
+
+/// how the context stores the components of a type
+enum class ComponentStorage
+{
+    Archetype, ///< in the column of the entity's archetype, fastest to iterate together
+    SparseSet  ///< in a sparse set per ComponentID, cheapest to add and remove
+};
+
+/**
+ *  Selects the storage of a component type. Specialize it for types that are added and removed
+ *  frequently, such as tags:
+ *
+ *      template<>
+ *      struct tx::component_storage<SelectedTag>
+ *          : std::integral_constant<tx::ComponentStorage, tx::ComponentStorage::SparseSet> {};
+ *
+ *  A ComponentID that is used for a sparse set type must always be used with that type.
+ */
+template<typename C>
+struct component_storage
+    : std::integral_constant<ComponentStorage, ComponentStorage::Archetype>
+{
+};
+
+template<typename C>
+constexpr bool is_sparse_component_v =
+    component_storage<component_value_t<C>>::value == ComponentStorage::SparseSet;
+
+/// dense integer identifying a component type. Assigned on first use, only stable within a run.
+using ComponentTypeID = uint32_t;
+
+/**
+ *  Value of the context's change counter when a component was last written, see
+ *  Context::changeTick(). 64 bits so that it never wraps around.
+ */
+using ChangeTick = uint64_t;
+
+namespace detail
+{
+/// what the context needs to know about a component type it only knows by its ComponentTypeID
+struct ComponentTypeInfo
+{
+    const char*      name;     ///< human readable, for debugging only
+    bool             sparse;   ///< whether the type is stored in sparse sets
+    bool             copyable; ///< whether Context::ModifyingProxy::createEntities() can copy it
+    SnapshotEncoding encoding; ///< how the type is written to snapshots
+    uint32_t         size;     ///< sizeof the type, checked when reading snapshots
+    /// creates an empty column allocating from the given memory resource
+    std::unique_ptr<ComponentColumnBase> (*makeColumn)(std::pmr::memory_resource*);
+    /// creates an empty sparse set allocating from the given memory resource
+    std::unique_ptr<SparsePoolBase> (*makePool)(std::pmr::memory_resource*);
+};
+
+/// creates an empty archetype column for components of type C, defined in Archetype.h
+template<typename C>
+std::unique_ptr<ComponentColumnBase> makeColumn(std::pmr::memory_resource* resource);
+
+/// creates an empty sparse set for components of type C, defined in SparsePool.h
+template<typename C>
+std::unique_ptr<SparsePoolBase> makePool(std::pmr::memory_resource* resource);
+
+class ComponentTypeRegistry
+{
+public:
+    static ComponentTypeRegistry& instance()
+    {
+        static ComponentTypeRegistry registry;
+        return registry;
+    }
+
+    ComponentTypeID add(const ComponentTypeInfo& info)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const size_t                id = size_.load(std::memory_order_relaxed);
+        if (id / blockSize >= maxBlocks) throw std::length_error("Too many component types!");
+        std::unique_ptr<ComponentTypeInfo[]>& block = blocks_[id / blockSize];
+        if (!block) block.reset(new ComponentTypeInfo[blockSize]);
+        block[id % blockSize] = info;
+        // publishes the entry, lookups of the new id see it completely
+        size_.store(id + 1, std::memory_order_release);
+        return static_cast<ComponentTypeID>(id);
+    }
+
+    /// lock free, entries never move once they are added
+    const ComponentTypeInfo& operator[](ComponentTypeID id) const noexcept
+    {
+        // ids are only handed out after add() published them, this orders the reads after that
+        (void)size_.load(std::memory_order_acquire);
+        return blocks_[id / blockSize][id % blockSize];
+    }
+
+    /// looks up a type by its name, \return false if no type of that name was registered
+    bool find(std::string_view name, ComponentTypeID& id) const
+    {
+        const size_t n = size_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (name == (*this)[static_cast<ComponentTypeID>(i)].name) {
+                id = static_cast<ComponentTypeID>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static constexpr size_t blockSize = 256;
+    static constexpr size_t maxBlocks = 1024;
+
+    std::mutex                                                   mutex_; ///< serializes add()
+    std::atomic<size_t>                                          size_{0};
+    std::array<std::unique_ptr<ComponentTypeInfo[]>, maxBlocks> blocks_;
+};
+
+class ComponentIndexRegistry
+{
+public:
+    static ComponentIndexRegistry& instance()
+    {
+        static ComponentIndexRegistry registry;
+        return registry;
+    }
+
+    ComponentIndex get(const ComponentID& cId, ComponentTypeID typeId)
+    {
+        const IdentifierIndex       id = identifierIndex(cId);
+        std::lock_guard<std::mutex> lock(mutex_);
+        return indices_.emplace(std::make_pair(id, typeId), ComponentIndex(indices_.size()))
+            .first->second;
+    }
+
+private:
+    std::mutex                                                            mutex_;
+    std::map<std::pair<IdentifierIndex, ComponentTypeID>, ComponentIndex> indices_;
+};
+} // namespace detail
+
+/**
+ *  Identifies the type of a component, matches ComponentBase::typeId() of a Component<C>.
+ *  Checking a stored component's type is an integer compare, no RTTI is needed.
+ */
+template<typename C>
+ComponentTypeID componentTypeId() noexcept
+{
+    static const ComponentTypeID id = detail::ComponentTypeRegistry::instance().add(
+        detail::ComponentTypeInfo{detail::typeName<C>(), is_sparse_component_v<C>,
+                                  std::is_copy_constructible<C>::value, snapshot_encoding_v<C>,
+                                  sizeof(C), &detail::makeColumn<C>, &detail::makePool<C>});
+    return id;
+}
+
+/**
+ *  Registers the component types C..., like componentTypeId() does on first use. A process
+ *  that reads a snapshot before it used the types in a query or a Component has to register
+ *  them up front, snapshots match types by their registered name, see Context::readSnapshot().
+ */
+template<typename... C>
+void registerComponentTypes()
+{
+    ((void)componentTypeId<C>(), ...);
+}
+
+/// information about a registered component type
+inline const detail::ComponentTypeInfo& componentTypeInfo(ComponentTypeID id)
+{
+    return detail::ComponentTypeRegistry::instance()[id];
+}
+
+/**
+ *  The dense index of a component with the given ID and type, for ComponentMask. Looked up
+ *  when archetypes and aspects are created, not when they are matched.
+ */
+inline ComponentIndex componentIndex(const ComponentID& cId, ComponentTypeID typeId)
+{
+    return detail::ComponentIndexRegistry::instance().get(cId, typeId);
+}
+
+/**
+ *  Base class for all standalone components. Knows the type of the wrapped value, so that typed
+ *  access is a static_cast after comparing typeId() with componentTypeId<C>().
+ */
 class ComponentBase
 {
 public:
     virtual ~ComponentBase(){};
 
-    size_t hash() const noexcept { return typeid(*this).hash_code(); }
+    ComponentTypeID typeId() const noexcept { return typeId_; }
+
+    /// destroys the component and returns its memory to the resource it was allocated from
+    virtual void destroy(std::pmr::memory_resource* resource) noexcept = 0;
+
+protected:
+    explicit ComponentBase(ComponentTypeID typeId) : typeId_(typeId) {}
+
+private:
+    ComponentTypeID typeId_;
 };
 
+/// deleter for standalone components that were allocated with allocateComponent()
+struct ComponentDeleter
+{
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+
+    void operator()(ComponentBase* component) const noexcept { component->destroy(resource); }
+};
+
+using ComponentPtr = std::unique_ptr<ComponentBase, ComponentDeleter>;
+
 /**
  *  Templated class to easily define user-specified component types
  */
@@ -24,7 +245,7 @@ public:
     using IDValuePair = std::pair<ComponentID, WrappedClass>;
 
     // default constructor
-    Component() : value()
+    Component() : ComponentBase(componentTypeId<WrappedClass>()), value()
     {
         static_assert(std::is_move_constructible<WrappedClass>::value ||
                           std::is_copy_constructible<WrappedClass>::value,
@@ -34,14 +255,25 @@ public:
     // variadic constructor with at least one argument
     template<typename Arg1, typename... Args>
     Component(Arg1 arg1, Args... args)
-        : value(std::forward<Arg1>(arg1), std::forward<Args>(args)...)
+        : ComponentBase(componentTypeId<WrappedClass>()),
+          value(std::forward<Arg1>(arg1), std::forward<Args>(args)...)
     {
     }
 
-    Component(WrappedClass&& wrapped) : value(wrapped) {}
+    Component(WrappedClass&& wrapped)
+        : ComponentBase(componentTypeId<WrappedClass>()), value(std::move(wrapped))
+    {
+    }
 
     virtual ~Component(){};
 
+    void destroy(std::pmr::memory_resource* resource) noexcept override
+    {
+        std::pmr::polymorphic_allocator<Component> allocator(resource);
+        this->~Component();
+        allocator.deallocate(this, 1);
+    }
+
     Component& operator=(Component&& cmp) = delete;
     Component(Component& other)           = delete;
     Component(Component&& other)          = delete;
@@ -58,9 +290,33 @@ private:
     WrappedClass value;
 };
 
+/**
+ *  Creates a standalone component of type C from the given memory resource. Components of the
+ *  same type are all the same size, so a pool resource hands them out from the same slabs.
+ */
+template<typename C, typename... Args>
+ComponentPtr allocateComponent(std::pmr::memory_resource* resource, Args&&... args)
+{
+    std::pmr::polymorphic_allocator<Component<C>> allocator(resource);
+    Component<C>* component = allocator.allocate(1);
+    try
+    {
+        ::new (static_cast<void*>(component)) Component<C>(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        allocator.deallocate(component, 1);
+        throw;
+    }
+    return ComponentPtr(component, ComponentDeleter{resource});
+}
+
 template<typename WrappedClass>
 class Cmp : public ComponentID
 { /**/
 };
 
 } // namespace tx
+
+#include "Archetype.h"
+#include "SparsePool.h"
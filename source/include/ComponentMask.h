@@ -0,0 +1,70 @@
+#pragma once
+
+/**
+ *	\file ComponentMask.h
+ *	Sets of components as bitsets over their dense indices, see componentIndex(). Archetypes and
+ *	aspects both keep one, so checking whether an archetype has all components of an aspect
+ *	compares a few words instead of looking up every component.
+ */
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+namespace tx
+{
+
+/**
+ *  Dense integer identifying a component, i.e. a ComponentID together with the type stored
+ *  under it. Assigned on first use by componentIndex(), only stable within a run.
+ */
+using ComponentIndex = uint32_t;
+
+/**
+ *  A set of components. The first 64 indices are stored inline, so most masks never allocate
+ *  and comparing them does not follow a pointer. Higher indices go to overflow words, only as
+ *  many as the highest index needs.
+ */
+class ComponentMask
+{
+public:
+    void set(ComponentIndex index)
+    {
+        if (index < 64) {
+            first_ |= uint64_t(1) << index;
+            return;
+        }
+        const size_t word = index / 64 - 1;
+        if (word >= overflow_.size()) overflow_.resize(word + 1, 0);
+        overflow_[word] |= uint64_t(1) << (index % 64);
+    }
+
+    bool test(ComponentIndex index) const noexcept
+    {
+        if (index < 64) return (first_ >> index & 1) != 0;
+        const size_t word = index / 64 - 1;
+        return word < overflow_.size() && (overflow_[word] >> (index % 64) & 1) != 0;
+    }
+
+    /// whether all components of other are in this mask
+    bool contains(const ComponentMask& other) const noexcept
+    {
+        // the last overflow word is never zero, so more words mean components this one lacks
+        if (other.overflow_.size() > overflow_.size()) return false;
+        uint64_t missing = other.first_ & ~first_;
+        for (size_t w = 0; w < other.overflow_.size(); ++w)
+            missing |= other.overflow_[w] & ~overflow_[w];
+        return missing == 0;
+    }
+
+    bool operator==(const ComponentMask& other) const noexcept
+    {
+        return first_ == other.first_ && overflow_ == other.overflow_;
+    }
+
+private:
+    uint64_t              first_ = 0; ///< indices 0 to 63
+    std::vector<uint64_t> overflow_;  ///< indices from 64 on, 64 per word
+};
+
+} // namespace tx
@@ -1,8 +1,20 @@
 #include "Context.h"
 
 #include "Entity.h"
+#include "MappedSnapshot.h"
 #include "System.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
 namespace tx
 {
 
@@ -11,33 +23,160 @@ void Context::emplaceSystem(Args... args)
 {
     // TODO check if already in there
     systems_.emplace_back(std::make_unique<S>(std::forward<Args>(args)...));
+
+    // add the system to the dependency graph
+    const size_t index  = systems_.size() - 1;
+    const auto&  access = systems_.back()->componentAccess();
+    systemGraph_.emplace_back();
+    for (size_t i = 0; i < index; ++i)
+    {
+        if (systems_[i]->componentAccess().conflictsWith(access)) {
+            systemGraph_[i].successors.push_back(index);
+            systemGraph_[index].predecessors.push_back(i);
+        }
+    }
+
+    // route component events to the new system
+    SystemBase* system = systems_.back().get();
+    if (system->componentInterests().empty())
+        componentWildcards_.push_back(system);
+    else
+        for (const auto& cId : system->componentInterests())
+            componentSubscribers_[cId].push_back(system);
+
+    // route system events between the new system and all others, including itself
+    auto subscribe = [this](const SystemID& sId, SystemBase* subscriber) {
+        auto& subscribers = systemSubscribers_[sId];
+        if (std::find(subscribers.begin(), subscribers.end(), subscriber) == subscribers.end())
+            subscribers.push_back(subscriber);
+    };
+    const SystemID id = system->getID();
+    for (auto& other : systems_)
+    {
+        const SystemID otherId = other->getID();
+        if (system->isInterested(otherId)) subscribe(otherId, system);
+        if (other.get() != system && other->isInterested(id)) subscribe(id, other.get());
+    }
+
     systems_.back()->init(*this);
 }
 
-TaskFuture<size_t> Context::each(const std::function<void(const EntityID&, Entity&)>&& fn)
+inline TaskFuture<size_t>
+Context::each(const std::function<void(const EntityID&, const EntityView&)>&& fn)
 {
     std::promise<size_t> pr;
     // TODO acquire lock over all entities
     size_t n = 0;
-    for (auto& e : entities_)
+    for (auto& a : archetypes_)
     {
-        fn(e.first, e.second);
-        ++n;
+        for (size_t row = 0; row < a->size(); ++row)
+            fn(entityTable_.name(a->entities()[row]), EntityView(a.get(), row));
+        n += a->size();
     }
     pr.set_value(n);
     return pr.get_future();
 }
 
+// each() is eachChanged() with since = 0, every component was written at or after tick 0
+
+template<typename ArrayN, typename Fn>
+TaskFuture<size_t> Context::each(ArrayN cIds, Fn fn, Execution execution)
+{
+    return each_variadic_impl<ArrayN, Fn>::impl(*this, cIds, fn, execution, 0);
+}
+
+template<typename ArrayN, typename Fn>
+TaskFuture<size_t> Context::each(ArrayN cIds, Fn fn, Execution execution) const
+{
+    return each_variadic_impl<ArrayN, Fn>::impl_const(*this, cIds, fn, execution, 0);
+}
+
+template<typename... C, typename Fn>
+TaskFuture<size_t> Context::each(const Query<C...>& query, Fn fn, Execution execution)
+{
+    return each_variadic_impl<std::array<ComponentID, sizeof...(C)>, Fn>::impl(*this, query, fn,
+                                                                               execution, 0);
+}
+
+template<typename... C, typename Fn>
+TaskFuture<size_t> Context::each(const Query<C...>& query, Fn fn, Execution execution) const
+{
+    return each_variadic_impl<std::array<ComponentID, sizeof...(C)>, Fn>::impl_const(
+        *this, query, fn, execution, 0);
+}
+
+template<typename ArrayN, typename Fn>
+TaskFuture<size_t> Context::eachChanged(ArrayN cIds, ChangeTick since, Fn fn, Execution execution)
+{
+    return each_variadic_impl<ArrayN, Fn>::impl(*this, cIds, fn, execution, since);
+}
+
 template<typename ArrayN, typename Fn>
-TaskFuture<size_t> Context::each(ArrayN cIds, Fn fn)
+TaskFuture<size_t> Context::eachChanged(ArrayN cIds, ChangeTick since, Fn fn,
+                                        Execution execution) const
+{
+    return each_variadic_impl<ArrayN, Fn>::impl_const(*this, cIds, fn, execution, since);
+}
+
+template<typename... C, typename Fn>
+TaskFuture<size_t> Context::eachChanged(const Query<C...>& query, ChangeTick since, Fn fn,
+                                        Execution execution)
 {
-    return each_variadic_impl<ArrayN, Fn>::impl(*this, cIds, fn);
+    return each_variadic_impl<std::array<ComponentID, sizeof...(C)>, Fn>::impl(*this, query, fn,
+                                                                               execution, since);
+}
+
+template<typename... C, typename Fn>
+TaskFuture<size_t> Context::eachChanged(const Query<C...>& query, ChangeTick since, Fn fn,
+                                        Execution execution) const
+{
+    return each_variadic_impl<std::array<ComponentID, sizeof...(C)>, Fn>::impl_const(
+        *this, query, fn, execution, since);
 }
 
 template<typename ArrayN, typename Fn>
-TaskFuture<size_t> Context::each(ArrayN cIds, Fn fn) const
+TaskFuture<size_t> Context::eachChunk(ArrayN cIds, Fn fn, Execution execution)
 {
-    return each_variadic_impl<ArrayN, Fn>::impl_const(*this, cIds, fn);
+    return each_chunk_variadic_impl<ArrayN, Fn>::impl(*this, cIds, fn, execution);
+}
+
+template<typename ArrayN, typename Fn>
+TaskFuture<size_t> Context::eachChunk(ArrayN cIds, Fn fn, Execution execution) const
+{
+    return each_chunk_variadic_impl<ArrayN, Fn>::impl_const(*this, cIds, fn, execution);
+}
+
+template<typename... C, typename Fn>
+TaskFuture<size_t> Context::eachChunk(const Query<C...>& query, Fn fn, Execution execution)
+{
+    return each_chunk_variadic_impl<std::array<ComponentID, sizeof...(C)>, Fn>::impl(
+        *this, query, fn, execution);
+}
+
+template<typename... C, typename Fn>
+TaskFuture<size_t> Context::eachChunk(const Query<C...>& query, Fn fn, Execution execution) const
+{
+    return each_chunk_variadic_impl<std::array<ComponentID, sizeof...(C)>, Fn>::impl_const(
+        *this, query, fn, execution);
+}
+
+template<typename... C>
+const Query<C...>& Context::query(const std::array<ComponentID, sizeof...(C)>& cIds) const
+{
+    Archetype::Key key;
+    key.reserve(sizeof...(C));
+    const std::array<ComponentTypeID, sizeof...(C)> types{{componentTypeId<C>()...}};
+    for (size_t i = 0; i < cIds.size(); ++i)
+        key.push_back(Archetype::keyEntry(cIds[i], types[i]));
+
+    std::lock_guard<std::mutex> lock(queryMutex_);
+    std::unique_ptr<QueryBase>& query = queries_[std::move(key)];
+    if (!query) {
+        query = std::make_unique<Query<C...>>(cIds);
+        for (auto& a : archetypes_)
+            query->addIfMatching(*a);
+    }
+    return static_cast<const Query<C...>&>(*query);
 }
 
 template<typename Fn>
@@ -56,133 +195,1525 @@ TaskFuture<typename function_traits<Fn>::result_type> Context::exec(Fn&& fn)
     return exec_variadic_impl<Fn>::impl(*this, fn);
 }
 
-void Context::updateSystems()
+template<typename ReturnType, typename Proxy, typename Fn>
+TaskFuture<ReturnType> Context::execWith(const Fn& fn)
 {
-    for (auto& s : systems_)
+    if constexpr (std::is_same<Proxy, ModifyingProxy>::value) {
+        auto                    pending = std::make_unique<PendingModification<ReturnType, Fn>>(fn);
+        std::future<ReturnType> future  = pending->getFuture();
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex_);
+            pendingModifications_.push_back(std::move(pending));
+        }
+        // waiting for the future applies the queued functionals right away, unless it is a tick
+        return TaskFuture<ReturnType>(std::move(future),
+                                      [this]() { return applyModifications(true); });
+    }
+    else
     {
-        if (!s->isValid()) {
-            if (s->update(*this)) {
-                s->setValid();
-            }
-            emitEvent(Event(Event::SYSTEMUPDATED, s->getID()));
+        return threadPool_.submit([this, fn]() -> ReturnType {
+            std::shared_lock<std::shared_mutex> lock(proxyMutex_);
+            ReadOnlyProxy                       proxy(*this);
+            return fn(proxy);
+        });
+    }
+}
+
+inline bool Context::applyModifications(bool waiting)
+{
+    // locked before taking the queue, so that concurrent calls apply it in order
+    std::unique_lock<std::shared_mutex> lock(proxyMutex_);
+    if (waiting && ticking_) {
+        // the systems are iterating the context, the tick end applies the functionals
+        if (CommandScope::current().inSystemUpdate())
+            throw std::logic_error("Modifications can not be waited for in a system update!");
+        return false;
+    }
+    std::vector<std::unique_ptr<PendingModificationBase>> batch;
+    {
+        std::lock_guard<std::mutex> pendingLock(pendingMutex_);
+        batch.swap(pendingModifications_);
+    }
+    if (batch.empty()) return false;
+
+    // one proxy for all of them, their events are emitted at once
+    std::exception_ptr error;
+    {
+        ModifyingProxy proxy(*this);
+        for (auto& m : batch)
+            m->run(proxy);
+        try
+        {
+            proxy.flushEvents();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
         }
     }
+    lock.unlock();
+    // the functionals did run, their futures are fulfilled even if the events were lost
+    for (auto& m : batch)
+        m->fulfill();
+    if (error) std::rethrow_exception(error);
+    return true;
 }
 
-void Context::emitEvent(const Event& event)
+inline bool Context::playbackCommands()
 {
-    if (event.type == Event::SYSTEMUPDATED) {
-        std::cout << "\t\t"
-                  << "Event emitted for System " << event.sId << std::endl;
-        for (auto& s : systems_)
+    std::unique_lock<std::shared_mutex> lock(proxyMutex_);
+
+    // take the commands of all buffers, threads keep recording into the emptied ones
+    std::vector<std::vector<CommandBuffer::Command>> commands;
+    std::vector<std::vector<CommandBuffer::Segment>> segments;
+    {
+        std::lock_guard<std::mutex> buffersLock(commandBuffersMutex_);
+        for (auto& b : commandBuffers_)
         {
-            if (s->isInterested(event.sId)) {
-                s->pushEvent(event);
+            CommandBuffer&              buffer = *b.second;
+            std::lock_guard<std::mutex> bufferLock(buffer.mutex_);
+            if (buffer.commands_.empty()) continue;
+            commands.emplace_back().swap(buffer.commands_);
+            segments.emplace_back().swap(buffer.segments_);
+        }
+    }
+    if (commands.empty()) return false;
+
+    // the commands of every segment, ordered by the keys of the segments
+    struct Range
+    {
+        const std::vector<uint32_t>* key;
+        CommandBuffer::Command*      first;
+        CommandBuffer::Command*      last;
+    };
+    std::vector<Range> ranges;
+    for (size_t b = 0; b < commands.size(); ++b)
+    {
+        for (size_t s = 0; s < segments[b].size(); ++s)
+        {
+            const size_t end =
+                s + 1 < segments[b].size() ? segments[b][s + 1].begin : commands[b].size();
+            ranges.push_back(Range{&segments[b][s].key, commands[b].data() + segments[b][s].begin,
+                                   commands[b].data() + end});
+        }
+    }
+    // stable, so that the segments of a job interrupted by another one keep their order
+    std::stable_sort(ranges.begin(), ranges.end(),
+                     [](const Range& a, const Range& b) { return *a.key < *b.key; });
+
+    // one proxy for all of them, their events are emitted at once
+    ModifyingProxy proxy(*this);
+    for (const Range& r : ranges)
+    {
+        for (CommandBuffer::Command* c = r.first; c != r.last; ++c)
+            c->apply(proxy, *c);
+    }
+    proxy.flushEvents();
+    return true;
+}
+
+inline Context::CommandBuffer& Context::commands()
+{
+    // the buffer of the context used last on this thread
+    struct Cached
+    {
+        uint64_t       contextId;
+        CommandBuffer* buffer;
+    };
+    static thread_local Cached cached{0, nullptr};
+    if (cached.contextId == contextId_) return *cached.buffer;
+
+    const std::thread::id       self = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(commandBuffersMutex_);
+    auto it = std::find_if(commandBuffers_.begin(), commandBuffers_.end(),
+                           [self](const auto& b) { return b.first == self; });
+    if (it == commandBuffers_.end()) {
+        std::unique_ptr<CommandBuffer> buffer(new CommandBuffer(*this));
+        it = commandBuffers_.emplace(commandBuffers_.end(), self, std::move(buffer));
+    }
+    cached = Cached{contextId_, it->second.get()};
+    return *cached.buffer;
+}
+
+inline void Context::CommandBuffer::record(Command&& command)
+{
+    const CommandScope&         scope = CommandScope::current();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (segments_.empty() || segments_.back().scope != scope.id() ||
+        segments_.back().dispatches != scope.dispatches()) {
+        segments_.push_back(
+            Segment{scope.ownKey(), scope.id(), scope.dispatches(), commands_.size()});
+    }
+    commands_.push_back(std::move(command));
+}
+
+inline Context::CommandScope::CommandScope(std::vector<uint32_t>&& key)
+    : key_(std::move(key)), previous_(top())
+{
+    static std::atomic<uint64_t> nextId{1};
+    id_   = nextId.fetch_add(1, std::memory_order_relaxed);
+    top() = this;
+}
+
+inline Context::CommandScope*& Context::CommandScope::top()
+{
+    static thread_local CommandScope* scope = nullptr;
+    return scope;
+}
+
+inline Context::CommandScope& Context::CommandScope::current()
+{
+    if (top() == nullptr) {
+        // commands recorded outside of system updates are played back first
+        static thread_local CommandScope root({0});
+    }
+    return *top();
+}
+
+inline std::vector<uint32_t> Context::CommandScope::dispatchKey()
+{
+    std::vector<uint32_t> key = key_;
+    key.push_back(++dispatches_);
+    return key;
+}
+
+inline std::vector<uint32_t> Context::CommandScope::ownKey() const
+{
+    // after the chunks of the parallel each() calls so far, before the ones of the next
+    std::vector<uint32_t> key = key_;
+    key.push_back(dispatches_);
+    key.push_back(UINT32_MAX);
+    return key;
+}
+
+inline void Context::writeSnapshot(std::ostream& out) const
+{
+    std::shared_lock<std::shared_mutex> lock(proxyMutex_);
+    const std::streampos                start = out.tellp();
+    out.write(snapshotMagic, sizeof(snapshotMagic));
+    detail::writeRaw(out, snapshotByteOrder);
+    entityTable_.write(out);
+    detail::writeRaw(out, changeTick());
+
+    // per archetype the handles, the types of all columns and then the values column by column
+    const auto nArchetypes = std::count_if(archetypes_.begin(), archetypes_.end(),
+                                           [](const auto& a) { return a->size() > 0; });
+    detail::writeRaw(out, static_cast<uint32_t>(nArchetypes));
+    for (const auto& archetype : archetypes_)
+    {
+        if (archetype->size() == 0) continue;
+        detail::writeRaw(out, static_cast<uint64_t>(archetype->size()));
+        detail::writeRaw(out, archetype->entities().data(), archetype->size());
+
+        std::vector<size_t> columns;
+        for (size_t i = 0; i < archetype->signature().size(); ++i)
+        {
+            if (componentTypeInfo(archetype->column(i).typeId()).encoding !=
+                SnapshotEncoding::None)
+                columns.push_back(i);
+        }
+        detail::writeRaw(out, static_cast<uint32_t>(columns.size()));
+        for (size_t i : columns)
+            writeSnapshotSchema(out, archetype->signature()[i].first,
+                                archetype->column(i).typeId());
+        for (size_t i : columns)
+            writeSnapshotValues(out, start, archetype->column(i));
+    }
+
+    std::vector<std::pair<ComponentID, const SparsePoolBase*>> pools;
+    for (const auto& pool : sparsePools_)
+    {
+        if (pool.second->size() > 0 &&
+            componentTypeInfo(pool.second->typeId()).encoding != SnapshotEncoding::None)
+            pools.emplace_back(pool.first, pool.second.get());
+    }
+    detail::writeRaw(out, static_cast<uint32_t>(pools.size()));
+    for (const auto& pool : pools)
+    {
+        writeSnapshotSchema(out, pool.first, pool.second->typeId());
+        detail::writeRaw(out, static_cast<uint64_t>(pool.second->size()));
+        detail::writeRaw(out, pool.second->entities().data(), pool.second->size());
+        writeSnapshotValues(out, start, *pool.second);
+    }
+
+    // buffered bytes can fail to be written as well, e.g. on a full disk
+    out.flush();
+    if (!out) throw std::runtime_error("Snapshot could not be written!");
+}
+
+inline void Context::writeSnapshot(const std::string& path) const
+{
+    // renaming replaces the directory entry, a mapping of the old file keeps its own pages
+    const std::string temp = path + ".tmp";
+    try
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("Can not create snapshot " + temp + "!");
+        writeSnapshot(out);
+        out.close();
+        if (!out) throw std::runtime_error("Snapshot could not be written!");
+    }
+    catch (...)
+    {
+        std::remove(temp.c_str());
+        throw;
+    }
+#if !TX_HAS_MMAP
+    // rename() may not replace existing files here, the old one was read into memory anyway
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        throw std::runtime_error("Can not replace snapshot " + path + "!");
+    }
+}
+
+inline std::vector<SkippedSnapshotColumn> Context::readSnapshot(std::istream& in)
+{
+    return readSnapshot(in, nullptr);
+}
+
+inline std::vector<SkippedSnapshotColumn> Context::mapSnapshot(const std::string& path)
+{
+    auto         mapping = std::make_shared<detail::MappedSnapshot>(path);
+    std::istream in(mapping.get());
+    return readSnapshot(in, mapping);
+}
+
+inline std::vector<SkippedSnapshotColumn>
+Context::readSnapshot(std::istream& in, const std::shared_ptr<detail::MappedSnapshot>& mapping)
+{
+    std::unique_lock<std::shared_mutex> lock(proxyMutex_);
+    if (entityTable_.size() > 0)
+        throw std::runtime_error("Snapshots can only be read into a context without entities!");
+
+    char magic[sizeof(snapshotMagic)];
+    in.read(magic, sizeof(magic));
+    if (!in || !std::equal(magic, magic + sizeof(magic), snapshotMagic))
+        throw std::runtime_error("Not a snapshot, or one of another version!");
+    if (detail::readRaw<uint32_t>(in) != snapshotByteOrder)
+        throw std::runtime_error("Snapshot was written on a platform with another byte order!");
+    entityTable_.read(in);
+
+    // the loaded components count as written now, later ticks must not be older than the saved
+    const ChangeTick tick = std::max(changeTick(), detail::readRaw<ChangeTick>(in));
+    changeTick_.store(tick, std::memory_order_relaxed);
+
+    auto readHandles = [this, &in](size_t n) {
+        std::vector<EntityHandle> entities(n);
+        detail::readRaw(in, entities.data(), n);
+        for (EntityHandle entity : entities)
+        {
+            if (!entityTable_.isAlive(entity)) throw std::runtime_error("Snapshot is corrupt!");
+        }
+        return entities;
+    };
+
+    std::vector<SkippedSnapshotColumn> skipped;
+    auto skip = [&skipped](const SnapshotColumn& column, size_t n) {
+        auto it = std::find_if(skipped.begin(), skipped.end(), [&column](const auto& s) {
+            return s.cId == column.cId && s.typeName == column.typeName;
+        });
+        if (it == skipped.end())
+            skipped.push_back(SkippedSnapshotColumn{column.cId, column.typeName, n});
+        else
+            it->count += n;
+    };
+
+    std::vector<std::pair<ComponentID, std::vector<EntityHandle>>> created;
+    for (uint32_t a = detail::readRaw<uint32_t>(in); a > 0; --a)
+    {
+        const size_t              rows     = detail::readRaw<uint64_t>(in);
+        std::vector<EntityHandle> entities = readHandles(rows);
+
+        std::vector<SnapshotColumn> columns(detail::readRaw<uint32_t>(in));
+        Archetype::Signature        signature;
+        for (SnapshotColumn& column : columns)
+        {
+            column = readSnapshotSchema(in);
+            if (column.known) signature.emplace_back(column.cId, column.typeId);
+        }
+        std::sort(signature.begin(), signature.end(),
+                  [](const auto& a, const auto& b) { return a.first < b.first; });
+        auto duplicate = std::adjacent_find(
+            signature.begin(), signature.end(),
+            [](const auto& a, const auto& b) { return a.first == b.first; });
+        if (duplicate != signature.end()) throw std::runtime_error("Snapshot is corrupt!");
+
+        Archetype& archetype = getArchetype(
+            std::move(signature), [this](const std::pair<ComponentID, ComponentTypeID>& entry) {
+                return componentTypeInfo(entry.second).makeColumn(&componentMemory_);
+            });
+        const size_t first = archetype.appendEntities(entities.data(), rows);
+        for (size_t i = 0; i < rows; ++i)
+        {
+            EntityLocation& location = entityTable_.location(entities[i]);
+            if (location.archetype != nullptr) throw std::runtime_error("Snapshot is corrupt!");
+            location = EntityLocation{&archetype, first + i};
+        }
+
+        for (const SnapshotColumn& column : columns)
+        {
+            if (!beginSnapshotValues(in, column, rows)) {
+                skip(column, rows);
+                continue;
+            }
+            ComponentColumnBase& values =
+                archetype.column(static_cast<size_t>(archetype.columnIndex(column.cId)));
+            // only trivially copyable values can be adopted, their size was checked already
+            const size_t bytes   = rows * componentTypeInfo(column.typeId).size;
+            const bool   adopted = mapping != nullptr && mapping->remaining() >= bytes &&
+                                 values.adoptValues(mapping->position(), rows, mapping, tick);
+            if (adopted) {
+                in.ignore(static_cast<std::streamsize>(bytes));
             }
+            else
+            {
+                values.readValues(in, rows, tick);
+            }
+            if (isObserved(column.cId)) created.emplace_back(column.cId, entities);
+        }
+    }
+
+    // entities with only sparse components, in snapshots written before they had an archetype
+    for (EntityHandle entity : entityTable_.unlocated())
+    {
+        Archetype& empty              = emptyArchetype();
+        entityTable_.location(entity) = EntityLocation{&empty, empty.appendEntity(entity)};
+    }
+
+    for (uint32_t p = detail::readRaw<uint32_t>(in); p > 0; --p)
+    {
+        const SnapshotColumn      column   = readSnapshotSchema(in);
+        const size_t              n        = detail::readRaw<uint64_t>(in);
+        std::vector<EntityHandle> entities = readHandles(n);
+        SparsePoolBase*           pool     = nullptr;
+        if (column.known && componentTypeInfo(column.typeId).sparse)
+            pool = getPool(column.cId, column.typeId);
+        if (pool == nullptr || pool->size() > 0) {
+            SnapshotColumn unused = column;
+            unused.known          = false;
+            beginSnapshotValues(in, unused, n);
+            skip(column, n);
+            continue;
+        }
+        if (!beginSnapshotValues(in, column, n)) {
+            skip(column, n);
+            continue;
+        }
+        pool->readValues(in, entities.data(), n, tick);
+        if (isObserved(column.cId)) created.emplace_back(column.cId, std::move(entities));
+    }
+
+    for (const auto& c : created)
+        emitEntityEvents(Event::ENTITYCREATED, c.first, c.second);
+    return skipped;
+}
+
+inline void Context::writeSnapshotSchema(std::ostream& out, const ComponentID& cId,
+                                         ComponentTypeID typeId)
+{
+    const detail::ComponentTypeInfo& info = componentTypeInfo(typeId);
+    const std::string_view           name(info.name);
+    detail::writeRaw(out, cId);
+    detail::writeRaw(out, static_cast<uint32_t>(name.size()));
+    detail::writeRaw(out, name.data(), name.size());
+    detail::writeRaw(out, info.size);
+    detail::writeRaw(out, info.encoding);
+}
+
+inline Context::SnapshotColumn Context::readSnapshotSchema(std::istream& in)
+{
+    SnapshotColumn column;
+    column.cId = detail::readRaw<ComponentID>(in);
+    std::string& name = column.typeName;
+    name.assign(detail::readRaw<uint32_t>(in), '\0');
+    detail::readRaw(in, &name[0], name.size());
+    const uint32_t         size     = detail::readRaw<uint32_t>(in);
+    const SnapshotEncoding encoding = detail::readRaw<SnapshotEncoding>(in);
+
+    column.known = detail::ComponentTypeRegistry::instance().find(name, column.typeId) &&
+                   componentTypeInfo(column.typeId).size == size &&
+                   componentTypeInfo(column.typeId).encoding == encoding &&
+                   encoding != SnapshotEncoding::None;
+    return column;
+}
+
+template<typename Storage>
+void Context::writeSnapshotValues(std::ostream& out, std::streampos start, const Storage& storage)
+{
+    const detail::ComponentTypeInfo& info = componentTypeInfo(storage.typeId());
+    if (info.encoding == SnapshotEncoding::Bytes) {
+        // the size is known upfront, the values go straight from the storage to the stream
+        detail::writeRaw(out, static_cast<uint64_t>(storage.size()) * info.size);
+        const std::streampos pos     = out.tellp();
+        uint8_t              padding = 0;
+        if (start != std::streampos(-1) && pos != std::streampos(-1)) {
+            const size_t offset = static_cast<size_t>(pos - start) + sizeof(padding);
+            padding = static_cast<uint8_t>((snapshotAlignment - offset % snapshotAlignment) %
+                                           snapshotAlignment);
         }
+        const char zeros[snapshotAlignment] = {};
+        detail::writeRaw(out, padding);
+        detail::writeRaw(out, zeros, padding);
+        storage.writeValues(out);
     }
     else
     {
-        std::cout << "\t\t"
-                  << "Event emitted for Component " << event.cId << " of Entity " << event.eId
-                  << std::endl;
-        for (auto& s : systems_)
+        std::ostringstream values;
+        storage.writeValues(values);
+        const std::string bytes = values.str();
+        detail::writeRaw(out, static_cast<uint64_t>(bytes.size()));
+        detail::writeRaw(out, uint8_t(0));
+        detail::writeRaw(out, bytes.data(), bytes.size());
+    }
+}
+
+inline bool Context::beginSnapshotValues(std::istream& in, const SnapshotColumn& column,
+                                         size_t n)
+{
+    const uint64_t bytes = detail::readRaw<uint64_t>(in);
+    in.ignore(detail::readRaw<uint8_t>(in));
+    if (column.known) {
+        const detail::ComponentTypeInfo& info = componentTypeInfo(column.typeId);
+        if (info.encoding == SnapshotEncoding::Bytes && bytes != uint64_t(n) * info.size)
+            throw std::runtime_error("Snapshot is corrupt!");
+        return true;
+    }
+    in.ignore(static_cast<std::streamsize>(bytes));
+    if (!in) throw std::runtime_error("Snapshot ended unexpectedly!");
+    return false;
+}
+
+inline void Context::updateSystems()
+{
+    // the tick starts with the modifications queued since the last one
+    applyModifications();
+
+    // Systems invalidated while this tick is running will be updated in the next one
+    std::vector<size_t> scheduled;
+    size_t              nonExclusive = 0;
+    for (size_t i = 0; i < systems_.size(); ++i)
+    {
+        if (!systems_[i]->isValid()) {
+            scheduled.push_back(i);
+            if (!systems_[i]->componentAccess().exclusive) ++nonExclusive;
+        }
+    }
+
+    // waiting for modifications no longer applies them until the systems are done
+    setTicking(true);
+
+    // the first exception is rethrown once all systems are updated and the tick has ended
+    std::exception_ptr error;
+    auto               keepError = [&error](auto&& fn) {
+        try
+        {
+            fn();
+        }
+        catch (...)
         {
-            if (s->isInterested(*this, event.eId, event.cId)) {
+            if (!error) error = std::current_exception();
+        }
+    };
+
+    if (nonExclusive < 2) {
+        // Nothing can run concurrently, so don't bother the thread pool
+        for (size_t i : scheduled)
+            keepError([this, i]() { updateSystem(i); });
+    }
+    else
+    {
+        keepError([this, &scheduled]() { updateSystemsConcurrently(scheduled); });
+    }
+
+    // and ends with the commands and modifications the systems recorded
+    keepError([this]() { playbackCommands(); });
+    setTicking(false);
+    keepError([this]() { applyModifications(); });
+    if (error) std::rethrow_exception(error);
+}
+
+inline void Context::setTicking(bool ticking)
+{
+    std::unique_lock<std::shared_mutex> lock(proxyMutex_);
+    ticking_ = ticking;
+}
+
+inline void Context::updateSystemsConcurrently(const std::vector<size_t>& scheduled)
+{
+    auto state = std::make_shared<SystemUpdateState>(systems_.size());
+    for (size_t i : scheduled)
+        state->scheduled[i] = true;
+    for (size_t i : scheduled)
+    {
+        size_t pending = 0;
+        for (size_t p : systemGraph_[i].predecessors)
+            if (state->scheduled[p]) ++pending;
+        state->pending[i] = pending;
+    }
+    state->remaining = scheduled.size();
+
+    TaskFuture<void> done = threadPool_.makeTaskFuture(state->done.get_future());
+    for (size_t i : scheduled)
+    {
+        if (state->pending[i] == 0)
+            threadPool_.post([this, i, state]() { updateSystem(i, state); });
+    }
+    done.get();
+}
+
+inline void Context::updateSystem(size_t index)
+{
+    SystemBase&  system = *systems_[index];
+    CommandScope scope({1, static_cast<uint32_t>(index)});
+    TX_TRACE_INFO(System, "system update started", system.getID());
+    // set before the update, so that events pushed while it runs invalidate the system again
+    system.setValid();
+    bool valid = false;
+    try
+    {
+        valid = system.update(*this);
+    }
+    catch (...)
+    {
+        system.setInvalid();
+        throw;
+    }
+    if (!valid) {
+        system.setInvalid();
+    }
+    // writes from now on get a newer tick than the ones of this update. If update() threw, the
+    // tick is not taken, so the next update sees the same changes again
+    system.lastUpdateTick_ = changeTick_.fetch_add(1, std::memory_order_relaxed) + 1;
+    TX_TRACE_INFO(System, "system update finished (valid)", system.getID(), valid);
+    emitEvent(Event(Event::SYSTEMUPDATED, system.getID()));
+}
+
+inline void Context::updateSystem(size_t index, const std::shared_ptr<SystemUpdateState>& state)
+{
+    try
+    {
+        updateSystem(index);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(state->errorMutex);
+        if (!state->error) state->error = std::current_exception();
+    }
+
+    for (size_t s : systemGraph_[index].successors)
+    {
+        if (state->scheduled[s] && state->pending[s].fetch_sub(1) == 1)
+            threadPool_.post([this, s, state]() { updateSystem(s, state); });
+    }
+
+    if (state->remaining.fetch_sub(1) == 1) {
+        if (state->error)
+            state->done.set_exception(state->error);
+        else
+            state->done.set_value();
+    }
+}
+
+inline void Context::emitEvent(const Event& event) const
+{
+    if (event.type == Event::SYSTEMUPDATED) {
+        auto it = systemSubscribers_.find(event.sId);
+        TX_TRACE_VERBOSE(Event, "system event emitted (subscribers)", event.sId,
+                         it != systemSubscribers_.end() ? it->second.size() : 0);
+        if (it != systemSubscribers_.end()) {
+            for (SystemBase* s : it->second)
                 s->pushEvent(event);
+        }
+    }
+    else
+    {
+        emitComponentEvents(event.cId, &event, &event + 1);
+    }
+}
+
+inline void Context::emitEvents(std::vector<Event>& events) const
+{
+    if (events.empty()) return;
+    std::vector<ComponentID> components;
+    std::vector<uint32_t>    indices = internComponents(events, components);
+    deduplicateEvents(events, indices);
+
+    // one group per component, so that subscribers are looked up once and get all events at once.
+    // Counting sort by component index; events can not be assigned, so the groups are built in a
+    // new buffer.
+    std::vector<size_t> offsets(components.size() + 1, 0);
+    for (uint32_t c : indices)
+        ++offsets[c + 1];
+    for (size_t c = 1; c < offsets.size(); ++c)
+        offsets[c] += offsets[c - 1];
+    std::vector<size_t> order(events.size());
+    {
+        std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < events.size(); ++i)
+            order[next[indices[i]]++] = i;
+    }
+    std::vector<Event> grouped;
+    grouped.reserve(events.size());
+    for (size_t i : order)
+        grouped.push_back(events[i]);
+    events.swap(grouped);
+
+    for (size_t c = 0; c < components.size(); ++c)
+    {
+        if (offsets[c] == offsets[c + 1]) continue;
+        emitComponentEvents(components[c], events.data() + offsets[c],
+                            events.data() + offsets[c + 1]);
+    }
+}
+
+inline void Context::emitComponentEvents(const ComponentID& cId, const Event* first,
+                                         const Event* last) const
+{
+    auto it = componentSubscribers_.find(cId);
+    TX_TRACE_INFO(Event, "component events emitted (events, subscribers)", cId,
+                  static_cast<uint64_t>(last - first),
+                  (it != componentSubscribers_.end() ? it->second.size() : 0) +
+                      componentWildcards_.size());
+#if TX_TRACE_LEVEL >= 2
+    for (const Event* e = first; e != last; ++e)
+        TX_TRACE_VERBOSE(Event, "component event emitted (type, entity)", cId, e->type,
+                         e->entity.value());
+#endif
+
+    if (it != componentSubscribers_.end()) {
+        for (SystemBase* s : it->second)
+            s->pushEvents(first, last);
+    }
+    for (SystemBase* s : componentWildcards_)
+    {
+        for (const Event* e = first; e != last; ++e)
+        {
+            if (s->isInterested(*this, e->entity, e->cId)) {
+                s->pushEvent(*e);
+            }
+        }
+    }
+}
+
+inline void Context::emitEntityEvents(Event::EventType type, const ComponentID& cId,
+                                      const std::vector<EntityHandle>& entities) const
+{
+    if (entities.empty() || !isObserved(cId)) return;
+    std::vector<Event> events;
+    events.reserve(entities.size());
+    for (EntityHandle entity : entities)
+        events.emplace_back(type, entity, cId);
+    emitComponentEvents(cId, events.data(), events.data() + events.size());
+}
+
+inline std::vector<uint32_t> Context::internComponents(const std::vector<Event>&  events,
+                                                       std::vector<ComponentID>& components)
+{
+    std::vector<uint32_t> indices(events.size());
+    // batches usually touch a few components, the interned indices are only used for many.
+    // lookup holds the position + 1 in components by identifierIndex(), 0 if there is none
+    std::vector<uint32_t> lookup;
+    auto                  lookUp = [&lookup](const ComponentID& id) -> uint32_t& {
+        const IdentifierIndex index = identifierIndex(id);
+        if (index >= lookup.size()) lookup.resize(index + 1, 0);
+        return lookup[index];
+    };
+    uint32_t last = 0;
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const ComponentID& cId = events[i].cId;
+        if (components.empty() || !(components[last] == cId)) {
+            if (components.size() < internLinearLimit) {
+                auto it = std::find(components.begin(), components.end(), cId);
+                last    = static_cast<uint32_t>(it - components.begin());
+                if (it == components.end()) components.push_back(cId);
+            }
+            else
+            {
+                if (lookup.empty()) {
+                    for (uint32_t c = 0; c < components.size(); ++c)
+                        lookUp(components[c]) = c + 1;
+                }
+                uint32_t& entry = lookUp(cId);
+                if (entry == 0) {
+                    components.push_back(cId);
+                    entry = static_cast<uint32_t>(components.size());
+                }
+                last = entry - 1;
             }
         }
+        indices[i] = last;
+    }
+    return indices;
+}
+
+inline void Context::deduplicateEvents(std::vector<Event>& events, std::vector<uint32_t>& indices)
+{
+    // visit the events of every (entity, component) pair in their original order
+    struct Key
+    {
+        uint64_t entity;
+        uint32_t component;
+        uint32_t position;
+
+        bool operator<(const Key& other) const
+        {
+            return std::tie(entity, component, position) <
+                   std::tie(other.entity, other.component, other.position);
+        }
+    };
+    std::vector<Key> keys(events.size());
+    for (size_t i = 0; i < events.size(); ++i)
+        keys[i] = Key{events[i].entity.value(), indices[i], static_cast<uint32_t>(i)};
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<bool> keep(events.size(), true);
+    for (size_t i = 0; i < keys.size();)
+    {
+        const Key pair    = keys[i];
+        bool      added   = false;
+        bool      changed = false;
+        for (; i < keys.size() && keys[i].entity == pair.entity &&
+               keys[i].component == pair.component;
+             ++i)
+        {
+            const uint32_t position = keys[i].position;
+            switch (events[position].type)
+            {
+            case Event::COMPONENTADDED:
+                keep[position] = !added;
+                added          = true;
+                break;
+            case Event::COMPONENTCHANGED:
+                // a change right after adding the component is implied by the ADDED event
+                keep[position] = !added && !changed;
+                changed        = true;
+                break;
+            case Event::COMPONENTREMOVED:
+                added   = false;
+                changed = false;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    std::vector<Event>    kept;
+    std::vector<uint32_t> keptIndices;
+    kept.reserve(events.size());
+    keptIndices.reserve(events.size());
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        if (keep[i]) {
+            kept.push_back(events[i]);
+            keptIndices.push_back(indices[i]);
+        }
+    }
+    events.swap(kept);
+    indices.swap(keptIndices);
+}
+
+inline EntityView Context::getEntity(EntityHandle entity) const noexcept
+{
+    const EntityLocation* location = entityTable_.find(entity);
+    if (location == nullptr || location->archetype == nullptr) return EntityView();
+    return EntityView(location->archetype, location->row);
+}
+
+inline EntityHandle Context::createEntity(const EntityID& eId)
+{
+    EntityHandle entity = entityTable_.create(eId);
+    Archetype&   empty  = emptyArchetype();
+    entityTable_.location(entity) = EntityLocation{&empty, empty.appendEntity(entity)};
+    return entity;
+}
+
+inline EntityHandle Context::findOrCreateEntity(const EntityID& eId)
+{
+    EntityHandle entity = entityTable_.find(eId);
+    return entity.isNull() ? createEntity(eId) : entity;
+}
+
+inline Archetype& Context::emptyArchetype()
+{
+    return getArchetype(Archetype::Signature(), [](const std::pair<ComponentID, ComponentTypeID>&) {
+        return std::unique_ptr<ComponentColumnBase>();
+    });
+}
+
+inline std::vector<EntityHandle> Context::createEntities(size_t n, const Entity& prototype)
+{
+    for (const auto& c : prototype.components_)
+    {
+        const detail::ComponentTypeInfo& info = componentTypeInfo(c.second->typeId());
+        txAssert(info.copyable, "Component " << c.first << " of type " << info.name
+                                             << " is not copyable, it can not be a prototype!");
+        if (!info.copyable) return std::vector<EntityHandle>();
+    }
+
+    const ChangeTick          tick      = changeTick();
+    Archetype&                archetype = getArchetype(prototype);
+    std::vector<EntityHandle> entities  = appendEntities(archetype, n);
+    for (size_t i = 0; i < archetype.signature().size(); ++i)
+        archetype.column(i).appendCopies(
+            *prototype.components_.find(archetype.signature()[i].first)->second, n, tick);
+
+    for (const auto& c : prototype.components_)
+    {
+        if (!componentTypeInfo(c.second->typeId()).sparse) continue;
+        SparsePoolBase* pool = getPool(c.first, c.second->typeId());
+        if (pool != nullptr) pool->appendCopies(entities.data(), n, *c.second, tick);
+    }
+    return entities;
+}
+
+inline std::vector<EntityHandle> Context::createEntities(size_t n, const Prefab& prefab)
+{
+    txAssert(prefab.context_ == this, "The prefab was created by another context!");
+    if (prefab.context_ != this) return std::vector<EntityHandle>();
+
+    const ChangeTick          tick      = changeTick();
+    Archetype&                archetype = *prefab.archetype_;
+    std::vector<EntityHandle> entities  = appendEntities(archetype, n);
+    for (size_t i = 0; i < archetype.signature().size(); ++i)
+        archetype.column(i).appendCopies(prefab.defaults_.column(i), 0, n, tick);
+
+    for (const auto& c : prefab.sparseDefaults_)
+    {
+        SparsePoolBase* pool = getPool(c.first, c.second->typeId());
+        if (pool != nullptr) pool->appendCopies(entities.data(), n, *c.second, tick);
+    }
+    return entities;
+}
+
+inline std::vector<EntityHandle> Context::appendEntities(Archetype& archetype, size_t n)
+{
+    // reserve everything once, the caller fills the rows of all entities column by column
+    std::vector<EntityHandle> entities;
+    entities.reserve(n);
+    entityTable_.reserve(n);
+    archetype.reserve(archetype.size() + n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        EntityHandle entity           = entityTable_.create();
+        entityTable_.location(entity) = EntityLocation{&archetype, archetype.appendEntity(entity)};
+        entities.push_back(entity);
+    }
+    return entities;
+}
+
+inline const Prefab& Context::createPrefab(Entity&& prototype)
+{
+    // components that can not be copied are left out
+    for (auto it = prototype.components_.begin(); it != prototype.components_.end();)
+    {
+        const detail::ComponentTypeInfo& info = componentTypeInfo(it->second->typeId());
+        txAssert(info.copyable, "Component " << it->first << " of type " << info.name
+                                             << " is not copyable, it can not be in a prefab!");
+        it = info.copyable ? std::next(it) : prototype.components_.erase(it);
+    }
+
+    Archetype&              archetype = getArchetype(prototype);
+    std::unique_ptr<Prefab> prefab(new Prefab(*this, archetype, &componentMemory_));
+    for (auto& c : prototype.components_)
+    {
+        prefab->componentIds_.push_back(c.first);
+        if (componentTypeInfo(c.second->typeId()).sparse)
+            prefab->sparseDefaults_.emplace_back(c.first, std::move(c.second));
+    }
+
+    prefab->defaults_.appendEntity(EntityHandle());
+    for (size_t i = 0; i < archetype.signature().size(); ++i)
+        prefab->defaults_.column(i).moveAppendFrom(
+            *prototype.components_[archetype.signature()[i].first], 0);
+    prototype.components_.clear();
+
+    prefabs_.push_back(std::move(prefab));
+    return *prefabs_.back();
+}
+
+inline SparsePoolBase* Context::getPool(const ComponentID& cId, ComponentTypeID typeId)
+{
+    std::unique_ptr<SparsePoolBase>& pool = sparsePools_[cId];
+    if (!pool) pool = componentTypeInfo(typeId).makePool(&componentMemory_);
+    txAssert(pool->typeId() == typeId,
+             "Type mismatch! Component " << cId << " of type " << componentTypeInfo(typeId).name
+                                         << " can not be stored in a sparse set of type "
+                                         << componentTypeInfo(pool->typeId()).name << "!");
+    return pool->typeId() == typeId ? pool.get() : nullptr;
+}
+
+inline Archetype& Context::getArchetype(const Entity& entity)
+{
+    Archetype::Signature signature;
+    signature.reserve(entity.components_.size());
+    for (const auto& c : entity.components_)
+    {
+        if (!componentTypeInfo(c.second->typeId()).sparse)
+            signature.emplace_back(c.first, c.second->typeId());
+    }
+    std::sort(signature.begin(), signature.end(),
+              [](const std::pair<ComponentID, ComponentTypeID>& a,
+                 const std::pair<ComponentID, ComponentTypeID>& b) { return a.first < b.first; });
+    return getArchetype(
+        std::move(signature), [this](const std::pair<ComponentID, ComponentTypeID>& entry) {
+            return componentTypeInfo(entry.second).makeColumn(&componentMemory_);
+        });
+}
+
+inline void Context::removeEntity(EntityHandle entity)
+{
+    const EntityLocation* location = entityTable_.find(entity);
+    if (location == nullptr) return;
+    if (location->archetype != nullptr) removeRow(*location->archetype, location->row);
+    for (auto& pool : sparsePools_)
+        pool.second->remove(entity);
+    entityTable_.destroy(entity);
+}
+
+template<typename ColumnFactory>
+Archetype& Context::getArchetype(Archetype::Signature&& signature, ColumnFactory makeColumn)
+{
+    Archetype::Key key = Archetype::key(signature);
+    auto           it  = archetypeLookup_.find(key);
+    if (it != archetypeLookup_.end()) return *it->second;
+
+    auto archetype =
+        std::make_unique<Archetype>(std::move(signature), makeColumn, &componentMemory_);
+    archetypeLookup_.emplace(std::move(key), archetype.get());
+
+    std::lock_guard<std::mutex> lock(queryMutex_);
+    for (auto& query : queries_)
+        query.second->addIfMatching(*archetype);
+    archetypes_.push_back(std::move(archetype));
+    return *archetypes_.back();
+}
+
+inline void Context::removeRow(Archetype& archetype, size_t row)
+{
+    if (archetype.swapRemove(row)) entityTable_.location(archetype.entities()[row]).row = row;
+}
+
+inline void Context::setEntity(EntityHandle handle, Entity&& entity) noexcept
+{
+    const ChangeTick tick = changeTick();
+    // components stored in sparse sets go to their set directly, the others define the archetype
+    for (auto& pool : sparsePools_)
+        pool.second->remove(handle);
+    for (const auto& c : entity.components_)
+    {
+        if (!componentTypeInfo(c.second->typeId()).sparse) continue;
+        SparsePoolBase* pool = getPool(c.first, c.second->typeId());
+        if (pool != nullptr) pool->moveFrom(handle, *c.second, tick);
     }
+    Archetype& archetype = getArchetype(entity);
+
+    // remove the previous version of the entity
+    EntityLocation& location = entityTable_.location(handle);
+    if (location.archetype != nullptr) removeRow(*location.archetype, location.row);
+
+    size_t row = archetype.appendEntity(handle);
+    for (size_t i = 0; i < archetype.signature().size(); ++i)
+        archetype.column(i).moveAppendFrom(*entity.components_[archetype.signature()[i].first],
+                                           tick);
+    entity.components_.clear();
+
+    location = EntityLocation{&archetype, row};
 }
 
-Entity& Context::getEntity(const EntityID& eId) noexcept { return entities_[eId]; }
+inline bool Context::hasComponent(EntityHandle entity, const ComponentID& cId) const
+{
+    const EntityLocation* location = entityTable_.find(entity);
+    if (location == nullptr) return false;
+    if (location->archetype != nullptr && location->archetype->columnIndex(cId) >= 0) return true;
 
-const Entity& Context::getEntity(const EntityID& eId) const noexcept { return entities_[eId]; }
+    auto pool = sparsePools_.find(cId);
+    return pool != sparsePools_.end() && pool->second->contains(entity);
+}
 
-void Context::setEntity(const EntityID& eId, Entity&& entity) noexcept
+inline bool Context::removeComponent(EntityHandle entity, const ComponentID& cId)
 {
-    entities_[eId] = std::move(entity);
+    auto pool = sparsePools_.find(cId);
+    if (pool != sparsePools_.end() && pool->second->remove(entity)) return true;
+
+    EntityLocation& location = entityTable_.location(entity);
+    Archetype*      src      = location.archetype;
+    const size_t    srcRow   = location.row;
+    const int       idx      = src != nullptr ? src->columnIndex(cId) : -1;
+    if (idx < 0) return false;
+
+    // the entity moves to the archetype without the component
+    Archetype::Signature signature = src->signature();
+    signature.erase(signature.begin() + idx);
+    Archetype& dst = getArchetype(
+        std::move(signature), [src](const std::pair<ComponentID, ComponentTypeID>& entry) {
+            return src->column(static_cast<size_t>(src->columnIndex(entry.first))).cloneEmpty();
+        });
+
+    const size_t dstRow = dst.appendEntity(entity);
+    for (size_t i = 0; i < dst.signature().size(); ++i)
+    {
+        const int srcIdx = src->columnIndex(dst.signature()[i].first);
+        dst.column(i).moveAppendFrom(src->column(static_cast<size_t>(srcIdx)), srcRow);
+    }
+    removeRow(*src, srcRow);
+
+    location = EntityLocation{&dst, dstRow};
+    return true;
+}
+
+template<typename C>
+SparsePool<C>* Context::findPool(const ComponentID& cId) const
+{
+    auto it = sparsePools_.find(cId);
+    if (it == sparsePools_.end()) return nullptr;
+
+    txAssert(it->second->typeId() == componentTypeId<C>(),
+             "Type mismatch! Requested component type "
+                 << detail::typeName<C>() << " does not match with stored component type "
+                 << componentTypeInfo(it->second->typeId()).name << "!");
+    if (it->second->typeId() != componentTypeId<C>()) return nullptr;
+    return static_cast<SparsePool<C>*>(it->second.get());
+}
+
+template<typename C>
+SparsePool<C>& Context::getPool(const ComponentID& cId)
+{
+    std::unique_ptr<SparsePoolBase>& pool = sparsePools_[cId];
+    if (!pool) pool = std::make_unique<SparsePool<C>>(&componentMemory_);
+    txAssert(pool->typeId() == componentTypeId<C>(),
+             "Type mismatch! Component " << cId << " is already stored in a sparse set of type "
+                                         << componentTypeInfo(pool->typeId()).name << "!");
+    return static_cast<SparsePool<C>&>(*pool);
 }
 
 template<typename C, typename... Args>
-void Context::emplaceComponent(const EntityID& eId, const ComponentID& cId, Args... args)
+void Context::emplaceComponent(EntityHandle entity, const ComponentID& cId, Args... args)
 {
-    entities_[eId].components_.insert(
-        std::make_pair(cId, std::make_unique<Component<C>>(std::forward<Args>(args)...)));
+    const ChangeTick tick = changeTick();
+    // a component with the same ID in the other storage is replaced
+    if constexpr (is_sparse_component_v<C>) {
+        const EntityLocation& location = entityTable_.location(entity);
+        if (location.archetype != nullptr && location.archetype->columnIndex(cId) >= 0)
+            removeComponent(entity, cId);
+        getPool<C>(cId).emplace(entity, tick, std::forward<Args>(args)...);
+        return;
+    }
+    if (!sparsePools_.empty()) {
+        auto pool = sparsePools_.find(cId);
+        if (pool != sparsePools_.end()) pool->second->remove(entity);
+    }
+
+    EntityLocation& location = entityTable_.location(entity);
+    Archetype*      src      = location.archetype;
+    size_t          srcRow   = location.row;
+
+    if (src != nullptr) {
+        // replace the value in-place if the entity already has a component of that type
+        int idx = src->columnIndex(cId);
+        if (idx >= 0 && src->signature()[idx].second == componentTypeId<C>()) {
+            auto& column   = src->column<C>(static_cast<size_t>(idx));
+            column[srcRow] = C(std::forward<Args>(args)...);
+            column.markChanged(srcRow, tick);
+            return;
+        }
+    }
+
+    // otherwise, the entity moves to the archetype with the new component added
+    Archetype::Signature signature;
+    if (src != nullptr) signature = src->signature();
+    auto pos = std::lower_bound(signature.begin(), signature.end(), cId,
+                                [](const std::pair<ComponentID, ComponentTypeID>& p,
+                                   const ComponentID& id) { return p.first < id; });
+    if (pos != signature.end() && pos->first == cId)
+        pos->second = componentTypeId<C>(); // replaces a component of a different type
+    else
+        signature.emplace(pos, cId, componentTypeId<C>());
+
+    Archetype& dst =
+        getArchetype(std::move(signature),
+                     [&](const std::pair<ComponentID, ComponentTypeID>& entry)
+                         -> std::unique_ptr<ComponentColumnBase> {
+                         if (entry.first == cId)
+                             return std::make_unique<ComponentColumn<C>>(&componentMemory_);
+                         return src->column(static_cast<size_t>(src->columnIndex(entry.first)))
+                             .cloneEmpty();
+                     });
+
+    size_t dstRow = dst.appendEntity(entity);
+    for (size_t i = 0; i < dst.signature().size(); ++i)
+    {
+        const ComponentID& id = dst.signature()[i].first;
+        if (id == cId)
+            dst.column<C>(i).emplace_back(tick, std::forward<Args>(args)...);
+        else
+            dst.column(i).moveAppendFrom(src->column(static_cast<size_t>(src->columnIndex(id))),
+                                         srcRow);
+    }
+    if (src != nullptr) removeRow(*src, srcRow);
+
+    location = EntityLocation{&dst, dstRow};
 }
 
 template<typename C>
-void Context::setComponent(const EntityID& eId, const ComponentID& cId,
-                           std::unique_ptr<Component<C>> component)
+void Context::setComponent(EntityHandle entity, const ComponentID& cId, C&& componentData)
 {
-    entities_[eId].components_.insert(std::make_pair(cId, std::move(component)));
+    emplaceComponent<std::decay_t<C>>(entity, cId, std::forward<C>(componentData));
 }
 
 template<typename... ComponentTypes>
-void Context::setComponent(const EntityID& eId,
+void Context::setComponent(EntityHandle entity,
                            const std::pair<ComponentID, ComponentTypes>&... cIDValues)
 {
     using swallow = int[]; // guarantees left to right order
     (void)swallow{         // call setComponent for each pair
-                  0, (setComponent(eId, cIDValues.first, cIDValues.second))...};
+                  0, (setComponent(entity, cIDValues.first, cIDValues.second), 0)...};
 }
 
 template<typename C>
-bool Context::getComponent(const EntityID& eId, const ComponentID& cId, C& componentData) const
+bool Context::getComponent(EntityHandle entity, const ComponentID& cId, C& componentData) const
 {
-    const auto& e  = entities_[eId];
-    const auto& it = e.components_.find(cId);
-    if (it == e.components_.end()) return false;
+    if constexpr (is_sparse_component_v<C>) {
+        const SparsePool<C>* pool      = findPool<C>(cId);
+        const C*             component = pool != nullptr ? pool->find(entity) : nullptr;
+        if (component == nullptr) return false;
+        componentData = *component;
+        return true;
+    }
+
+    const EntityLocation* location = entityTable_.find(entity);
+    if (location == nullptr || location->archetype == nullptr) return false;
 
-    auto& cmp = it->second;
+    const Archetype& archetype = *location->archetype;
+    int              idx       = archetype.columnIndex(cId);
+    if (idx < 0) return false;
 
-    txAssert(dynamic_cast<Component<C>*>(cmp.get()) != nullptr,
+    txAssert(archetype.signature()[idx].second == componentTypeId<C>(),
              "Type mismatch! Requested component type "
-                 << typeid(Component<C>).name() << " does not match with stored component type "
-                 << typeid(*cmp).name() << "!");
+                 << detail::typeName<C>() << " does not match with stored component type "
+                 << archetype.column(idx).typeName() << "!");
+    if (archetype.signature()[idx].second != componentTypeId<C>()) return false;
 
-    componentData = *(*static_cast<Component<C>*>(
-        cmp.get())); // dereference the pointer, then call operator* on the Component<C> instance
+    componentData = archetype.column<C>(static_cast<size_t>(idx))[location->row];
     return true;
 }
 
 template<typename ComponentType>
-ComponentType& Context::getComponent(Entity& e, const ComponentID& cId) const
+ComponentType& Context::getComponent(const EntityLocation& location, const ComponentID& cId) const
 {
-    // The type of the internal component used for storage does not have a const qualifier, but C
-    // might have
-    using Component_t = Component<typename std::remove_const<ComponentType>::type>;
+    // The type of the stored component does not have a const qualifier, but C might have
+    using C = typename std::remove_const<ComponentType>::type;
 
-    txAssert(e.components_.find(cId) != e.components_.end(),
-             "Component " << cId << " does not exist!");
+    int idx = location.archetype->columnIndex(cId);
+    txAssert(idx >= 0, "Component " << cId << " does not exist!");
+    txAssert(location.archetype->signature()[idx].second == componentTypeId<C>(),
+             "Type mismatch! Requested component type "
+                 << detail::typeName<C>() << " does not match with stored component type "
+                 << location.archetype->column(idx).typeName() << "!");
 
-    auto& cmp = e.components_[cId];
+    return location.archetype->column<C>(static_cast<size_t>(idx))[location.row];
+}
 
-    txAssert(dynamic_cast<Component_t*>(cmp.get()) != nullptr,
-             "Type mismatch! Requested component type "
-                 << typeid(Component_t).name() << " does not match with stored component type "
-                 << typeid(*cmp).name() << "!");
-    txAssert(cmp.get() != nullptr, "Component pointer is null! This should not happen.. :(");
+template<typename... C, typename Fn, typename ArchetypeT, size_t N, size_t... CIndices>
+size_t Context::callFuncWithComponents(Fn& fn, ArchetypeT& archetype,
+                                       const std::array<ComponentID, N>& cIds,
+                                       std::index_sequence<CIndices...>, size_t beginRow,
+                                       size_t endRow, ChangeTick since) const
+{
+    // resolve the columns once, then walk all of them in lockstep
+    const std::array<ComponentColumnBase*, N> bases{{&archetype.column(
+        static_cast<size_t>(archetype.columnIndex(cIds[CIndices])))...}};
+    const auto columns =
+        std::make_tuple(static_cast<ComponentColumn<component_value_t<C>>*>(bases[CIndices])
+                            ->data()...);
+    const std::array<ChangeTick*, N> ticks{{bases[CIndices]->ticks()...}};
+    constexpr std::array<bool, N>    writable{
+        {!std::is_const<std::remove_reference_t<C>>::value...}};
+    const auto&      entities = archetype.entities();
+    const ChangeTick now      = changeTick();
+
+    ChangedEvents<C...> changed(*this, cIds, endRow - beginRow);
+    size_t              visited = 0;
+    try
+    {
+        if (since == 0) {
+            // every row is visited, so the ticks are written in bulk up front. If fn throws, the
+            // rows it did not get to are reported as changed as well, which is harmless.
+            for (size_t i = 0; i < N; ++i)
+                if (writable[i]) std::fill(ticks[i] + beginRow, ticks[i] + endRow, now);
+            for (size_t row = beginRow; row < endRow; ++row)
+            {
+                if constexpr (std::is_invocable<Fn&, const EntityHandle&, C...>::value)
+                    fn(entities[row], std::get<CIndices>(columns)[row]...);
+                else
+                    fn(entityTable_.name(entities[row]), std::get<CIndices>(columns)[row]...);
+                changed.add(entities[row]);
+            }
+            visited = endRow - beginRow;
+        }
+        else
+        {
+            for (size_t row = beginRow; row < endRow; ++row)
+            {
+                if (!((ticks[CIndices][row] >= since) || ...)) continue;
 
-    return *(*static_cast<Component_t*>(
-        cmp.get())); // dereference the pointer, then call operator* on the Component<C> instance
+                if constexpr (std::is_invocable<Fn&, const EntityHandle&, C...>::value)
+                    fn(entities[row], std::get<CIndices>(columns)[row]...);
+                else
+                    fn(entityTable_.name(entities[row]), std::get<CIndices>(columns)[row]...);
+                changed.add(entities[row]);
+                for (size_t i = 0; i < N; ++i)
+                    if (writable[i]) ticks[i][row] = now;
+                ++visited;
+            }
+        }
+    }
+    catch (...)
+    {
+        // the rows processed so far were still accessed
+        changed.flush();
+        throw;
+    }
+    changed.flush();
+    return visited;
 }
 
-template<typename... C, typename Fn, size_t N, size_t... CIndices, typename... FuncArgs>
-void Context::callFuncWithComponents(Fn fn, const EntityID& eId,
-                                     const std::array<ComponentID, N>& cIds,
-                                     std::index_sequence<CIndices...>, FuncArgs... funcArgs)
+template<typename... P, typename Fn, typename ArchetypeT, size_t N, size_t... CIndices>
+size_t Context::callFuncWithChunks(Fn& fn, ArchetypeT& archetype,
+                                   const std::array<ComponentID, N>& cIds,
+                                   std::index_sequence<CIndices...>, size_t beginRow,
+                                   size_t endRow) const
 {
-    fn(funcArgs...,
-       getComponent<typename std::remove_reference<C>::type>(entities_[eId], cIds[CIndices])...);
+    const std::array<ComponentColumnBase*, N> bases{{&archetype.column(
+        static_cast<size_t>(archetype.columnIndex(cIds[CIndices])))...}};
+    const auto columns = std::make_tuple(
+        static_cast<ComponentColumn<std::remove_cv_t<std::remove_pointer_t<P>>>*>(
+            bases[CIndices])
+            ->data()...);
+    constexpr std::array<bool, N> writable{{!std::is_const<std::remove_pointer_t<P>>::value...}};
+    const auto&                   entities = archetype.entities();
+    const ChangeTick              now      = changeTick();
+
+    // blocks of rows whose components fit into the L1 cache together
+    constexpr size_t rowBytes = (sizeof(std::remove_pointer_t<P>) + ... + 0);
+    constexpr size_t rows =
+        std::max<size_t>(eachChunkBytes / std::max<size_t>(rowBytes, 1), eachChunkMinRows);
+
+    ChangedEvents<std::remove_pointer_t<P>&...> changed(*this, cIds, endRow - beginRow);
+    const bool                                  recording = changed.recording();
+    try
+    {
+        for (size_t row = beginRow; row < endRow; row += rows)
+        {
+            const size_t count = std::min(rows, endRow - row);
+            for (size_t i = 0; i < N; ++i)
+            {
+                if (writable[i])
+                    std::fill(bases[i]->ticks() + row, bases[i]->ticks() + row + count, now);
+            }
+            fn(count, (std::get<CIndices>(columns) + row)...);
+            if (recording) {
+                for (size_t r = row; r < row + count; ++r)
+                    changed.add(entities[r]);
+            }
+        }
+    }
+    catch (...)
+    {
+        // the blocks processed so far were still accessed
+        changed.flush();
+        throw;
+    }
+    changed.flush();
+    return endRow - beginRow;
+}
+
+template<typename... C, typename Fn, size_t N, size_t... CIndices>
+size_t Context::callFuncWithSparseComponents(Fn& fn, const SparsePoolBase& pool,
+                                             const std::array<ComponentID, N>& cIds,
+                                             std::index_sequence<CIndices...>, size_t beginRow,
+                                             size_t endRow, ChangeTick since) const
+{
+    std::tuple<ComponentLocator<component_value_t<C>>...> locators{
+        ComponentLocator<component_value_t<C>>(*this, cIds[CIndices])...};
+    constexpr std::array<bool, N> writable{{!std::is_const<std::remove_reference_t<C>>::value...}};
+    const auto&                   entities = pool.entities();
+    const ChangeTick              now      = changeTick();
+
+    ChangedEvents<C...> changed(*this, cIds, endRow - beginRow);
+    size_t              visited = 0;
+    try
+    {
+        for (size_t row = beginRow; row < endRow; ++row)
+        {
+            const EntityHandle entity = entities[row];
+            const auto components = std::make_tuple(std::get<CIndices>(locators).find(entity)...);
+            if (((std::get<CIndices>(components).first == nullptr) || ...)) continue;
+
+            const std::array<ChangeTick*, N> ticks{{std::get<CIndices>(components).second...}};
+            if (since != 0 && !((*ticks[CIndices] >= since) || ...)) continue;
+
+            if constexpr (std::is_invocable<Fn&, const EntityHandle&, C...>::value)
+                fn(entity, *std::get<CIndices>(components).first...);
+            else
+                fn(entityTable_.name(entity), *std::get<CIndices>(components).first...);
+            changed.add(entity);
+            for (size_t i = 0; i < N; ++i)
+                if (writable[i]) *ticks[i] = now;
+            ++visited;
+        }
+    }
+    catch (...)
+    {
+        changed.flush();
+        throw;
+    }
+    changed.flush();
+    return visited;
+}
+
+template<typename... C, size_t N, size_t... CIndices>
+const SparsePoolBase* Context::smallestPool(const std::array<ComponentID, N>& cIds,
+                                            std::index_sequence<CIndices...>) const
+{
+    const SparsePoolBase* smallest = nullptr;
+    bool                  missing  = false;
+    auto                  consider = [&smallest, &missing](const SparsePoolBase* pool) {
+        if (pool == nullptr)
+            missing = true;
+        else if (smallest == nullptr || pool->size() < smallest->size())
+            smallest = pool;
+    };
 
     using swallow = int[]; // guarantees left to right order
-    (void)swallow{
-        // emits a changed event for every component that is not const qualified in the function
-        // argument list
-        0, (std::is_const<typename std::remove_reference<C>::type>::value
-                ? 0
-                : (void(emitEvent(Event(Event::COMPONENTCHANGED, eId, cIds[CIndices]))), 0))...};
+    (void)swallow{0, (is_sparse_component_v<C>
+                          ? (consider(findPool<component_value_t<C>>(cIds[CIndices])), 0)
+                          : 0)...};
+    return missing ? nullptr : smallest;
+}
+
+template<typename... C, typename Fn, typename ArchetypeT, size_t N>
+TaskFuture<size_t> Context::dispatchEach(const std::vector<ArchetypeT*>& sources,
+                                         const std::array<ComponentID, N>& cIds, Fn fn,
+                                         Execution execution, ChangeTick since) const
+{
+    // the sources are either archetypes or a single sparse set
+    auto run = [this, cIds, since](Fn& f, ArchetypeT& source, size_t begin, size_t end) {
+        if constexpr (std::is_base_of<SparsePoolBase, ArchetypeT>::value)
+            return callFuncWithSparseComponents<C...>(
+                f, source, cIds, std::index_sequence_for<C...>{}, begin, end, since);
+        else
+            return callFuncWithComponents<C...>(f, source, cIds, std::index_sequence_for<C...>{},
+                                                begin, end, since);
+    };
+    return dispatchRows(sources, std::move(fn), execution, run);
+}
+
+template<typename... P, typename Fn, typename ArchetypeT, size_t N>
+TaskFuture<size_t> Context::dispatchEachChunk(const std::vector<ArchetypeT*>& sources,
+                                              const std::array<ComponentID, N>& cIds, Fn fn,
+                                              Execution execution) const
+{
+    auto run = [this, cIds](Fn& f, ArchetypeT& source, size_t begin, size_t end) {
+        return callFuncWithChunks<P...>(f, source, cIds, std::index_sequence_for<P...>{}, begin,
+                                        end);
+    };
+    return dispatchRows(sources, std::move(fn), execution, run);
+}
+
+template<typename Fn, typename ArchetypeT, typename Run>
+TaskFuture<size_t> Context::dispatchRows(const std::vector<ArchetypeT*>& sources, Fn fn,
+                                         Execution execution, Run run) const
+{
+    size_t n = 0;
+    for (auto a : sources)
+        n += a->size();
+
+    if (execution == Execution::Sequential || n <= minEachChunkSize) {
+        TX_TRACE_INFO(Each, "each() dispatched sequentially (entities, sources)", n,
+                      sources.size());
+        size_t visited = 0;
+        for (auto a : sources)
+            visited += run(fn, *a, 0, a->size());
+        std::promise<size_t> pr;
+        pr.set_value(visited);
+        return pr.get_future();
+    }
+
+    // Shared by all chunks, the last chunk to finish fulfills the promise
+    struct EachState
+    {
+        explicit EachState(Fn&& fn_) : fn(std::move(fn_)) {}
+
+        Fn                    fn;
+        std::atomic<size_t>   pendingChunks{0};
+        std::atomic<size_t>   visited{0};
+        std::promise<size_t>  promise;
+        std::mutex            errorMutex;
+        std::exception_ptr    error;
+        std::vector<uint32_t> commandKey; ///< the chunks record commands in scopes below it
+    };
+    auto state        = std::make_shared<EachState>(std::move(fn));
+    state->commandKey = CommandScope::current().dispatchKey();
+
+    // a few chunks per worker for load balancing, but chunks never span several sources
+    const size_t chunkSize =
+        std::max<size_t>(minEachChunkSize, n / (4 * std::max<size_t>(threadPool_.size(), 1)));
+    size_t nChunks = 0;
+    for (auto a : sources)
+        nChunks += (a->size() + chunkSize - 1) / chunkSize;
+    state->pendingChunks = nChunks;
+    TX_TRACE_INFO(Each, "each() dispatched in parallel (entities, chunks)", n, nChunks);
+
+    TaskFuture<size_t> result = threadPool_.makeTaskFuture(state->promise.get_future());
+
+    uint32_t chunk = 0;
+    for (auto a : sources)
+    {
+        for (size_t begin = 0; begin < a->size(); begin += chunkSize)
+        {
+            const size_t end = std::min(begin + chunkSize, a->size());
+            threadPool_
+                .submit([state, a, run, begin, end, chunk]() {
+                    try
+                    {
+                        // commands are played back in the order of the chunks
+                        std::vector<uint32_t> key = state->commandKey;
+                        key.push_back(chunk);
+                        CommandScope scope(std::move(key));
+                        state->visited += run(state->fn, *a, begin, end);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(state->errorMutex);
+                        if (!state->error) state->error = std::current_exception();
+                    }
+                    TX_TRACE_INFO(Each, "each() chunk processed (begin, end)", begin, end);
+                    if (state->pendingChunks.fetch_sub(1) == 1) {
+                        if (state->error)
+                            state->promise.set_exception(state->error);
+                        else
+                            state->promise.set_value(state->visited);
+                    }
+                })
+                .detach();
+            ++chunk;
+        }
+    }
+    return result;
+}
+
+template<typename... C, typename Fn, size_t N>
+TaskFuture<size_t> Context::dispatchSparseEach(const std::array<ComponentID, N>& cIds, Fn fn,
+                                               Execution execution, ChangeTick since) const
+{
+    std::vector<const SparsePoolBase*> pools;
+    const SparsePoolBase* pool = smallestPool<C...>(cIds, std::index_sequence_for<C...>{});
+    if (pool != nullptr && pool->size() > 0) pools.push_back(pool);
+    return dispatchEach<C...>(pools, cIds, std::move(fn), execution, since);
 }
 
 } // namespace tx
@@ -1,25 +1,46 @@
 #pragma once
 
+#include "Archetype.h"
+#include "Aspect.h"
+#include "Entity.h"
+#include "EntityHandle.h"
 #include "Event.h"
 #include "Identifier.h"
+#include "IdentifierMap.h"
+#include "Prefab.h"
+#include "Query.h"
+#include "SparsePool.h"
 #include "ThreadPool.h"
+#include "Trace.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <future>
 #include <iostream>
-#include <list>
+#include <map>
+#include <memory_resource>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <tuple>
 #include <type_traits>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace tx
 {
 
-class Entity;
 template<typename Derived>
 class System;
 class SystemBase;
+namespace detail
+{
+class MappedSnapshot;
+}
 
 /**
  *  The context is the central storage/exchange object. It handles
@@ -29,7 +50,9 @@ class Context
 public:
     /**
      *  Exposes a the read-only part of the context API. Handling an instance of this
-     *  proxy guarantees threadsafe access.
+     *  proxy guarantees threadsafe access: exec() holds a shared lock on the context while the
+     *  functional runs, so any number of read-only functionals run concurrently, but never
+     *  alongside a ModifyingProxy.
      */
     class ReadOnlyProxy
     {
@@ -39,11 +62,33 @@ public:
         virtual ~ReadOnlyProxy(){};
 
         /**
-         *  Returns an entity with the specified eId. If none exists, a new one will be created.
+         *  Returns a view of the entity with the specified eId. If none exists, the returned view
+         *  is invalid.
+         */
+        EntityView getEntity(const EntityID& eId) const noexcept
+        {
+            return parent_.getEntity(parent_.entityTable_.find(eId));
+        }
+
+        EntityView getEntity(EntityHandle entity) const noexcept
+        {
+            return parent_.getEntity(entity);
+        }
+
+        /**
+         *  Returns the handle of the entity with the given name, or the null handle if none
+         *  exists. Resolve names once and use handles afterwards, they are much cheaper to look up.
+         */
+        EntityHandle getHandle(const EntityID& eId) const { return parent_.entityTable_.find(eId); }
+
+        /**
+         *  Returns the name of an entity, or an empty EntityID if it does not exist or has no
+         *  name.
          */
-        const Entity& getEntity(const EntityID& eId) const noexcept
+        EntityID getEntityID(EntityHandle entity) const noexcept
         {
-            return parent_.entities_[eId];
+            return parent_.entityTable_.isAlive(entity) ? parent_.entityTable_.name(entity)
+                                                        : EntityID();
         }
 
         /**
@@ -53,7 +98,13 @@ public:
         template<typename C>
         bool getComponent(const EntityID& eId, const ComponentID& cId, C& componentData) const
         {
-            return parent_.getComponent(eId, cId, componentData);
+            return parent_.getComponent(parent_.entityTable_.find(eId), cId, componentData);
+        }
+
+        template<typename C>
+        bool getComponent(EntityHandle entity, const ComponentID& cId, C& componentData) const
+        {
+            return parent_.getComponent(entity, cId, componentData);
         }
 
     protected:
@@ -64,33 +115,153 @@ public:
      *  Exposes read-write access to the context. Obtaining non-const access to
      *  components will generate COMPONENTCHANGED events, regardless of whether the component
      *  was actually modified.
-     *  Events will be cached and emitted once this proxy object is destroyed.
-     *  \note: Currently, multiple getComponent() calls for the same component will also result
-     *      in multiple events.
+     *  Events will be cached and emitted at once when this proxy object is destroyed. Repeated
+     *  events about the same component of an entity are only emitted once.
+     *  exec() queues modifying functionals and applies all queued ones at once, with a single
+     *  proxy under an exclusive lock on the context, so they are serialized with all other
+     *  functionals and their events are deduplicated and emitted together.
      */
-    class ModifyingProxy
+    class ModifyingProxy : public ReadOnlyProxy
     {
     public:
         // Should only be instantiated by the parent context
-        ModifyingProxy(Context& parent) : parent_(parent){};
-        virtual ~ModifyingProxy(){};
+        ModifyingProxy(Context& parent) : ReadOnlyProxy(parent){};
+
+        /// emits the events that are still cached, if the context did not flush them already
+        virtual ~ModifyingProxy()
+        {
+            try
+            {
+                flushEvents();
+            }
+            catch (...)
+            {
+                // emitting allocates; losing the events beats terminating, e.g. while unwinding
+            }
+        }
 
         /**
-         *  Returns an entity with the specified eId. If none exists, a new one will be created.
+         *  Emits the events cached so far. The context calls this after the functionals of
+         *  exec() and the recorded commands were applied, so that failing to emit them is
+         *  reported instead of happening in the destructor.
          */
-        const Entity& getEntity(const EntityID& eId) const noexcept
+        void flushEvents()
         {
-            return parent_.entities_[eId];
+            parent_.emitEvents(events_);
+            events_.clear();
         }
 
         /**
-         *  Returns the component of an entity. If either entity or component do not exist,
-         *  an instance is created using default constructor.
+         *  Creates a new entity without any components. If a name is given and an entity with
+         *  that name already exists, the existing entity is returned.
          */
-        template<typename C>
-        bool getComponent(const EntityID& eId, const ComponentID& cId, C& componentData) const
+        EntityHandle createEntity(const EntityID& eId = EntityID())
         {
-            return parent_.getComponent(eId, cId, componentData);
+            if (!(eId == EntityID())) {
+                EntityHandle existing = parent_.entityTable_.find(eId);
+                if (!existing.isNull()) return existing;
+            }
+            return parent_.createEntity(eId);
+        }
+
+        /**
+         *  Removes an entity and all of its components. Handles to the entity become invalid.
+         */
+        void removeEntity(const EntityID& eId) { removeEntity(parent_.entityTable_.find(eId)); }
+
+        void removeEntity(EntityHandle entity)
+        {
+            const EntityLocation* location = parent_.entityTable_.find(entity);
+            if (location == nullptr) return;
+            for (const auto& c : location->archetype->signature())
+                events_.emplace_back(Event::COMPONENTREMOVED, entity, c.first);
+            for (const auto& pool : parent_.sparsePools_)
+            {
+                if (pool.second->contains(entity))
+                    events_.emplace_back(Event::COMPONENTREMOVED, entity, pool.first);
+            }
+
+            parent_.removeEntity(entity);
+        }
+
+        /**
+         *  Creates n entities with copies of the components of prototype, which all have to be
+         *  copyable. Storage is reserved once and the components are copied column by column.
+         *  Instead of the ADDED events of the single entity API, one ENTITYCREATED event per
+         *  entity and component is passed to the interested systems in one batch per component.
+         *  To keep the order of events, the events cached so far are emitted before.
+         *  \return the handles of the new entities
+         */
+        std::vector<EntityHandle> createEntities(size_t n, const Entity& prototype)
+        {
+            flushEvents();
+
+            std::vector<EntityHandle> entities = parent_.createEntities(n, prototype);
+            if (!entities.empty()) {
+                for (const auto& c : prototype.components_)
+                    parent_.emitEntityEvents(Event::ENTITYCREATED, c.first, entities);
+            }
+            return entities;
+        }
+
+        /**
+         *  Registers a template entity whose components, which all have to be copyable, are the
+         *  default values of its instances. The archetype of the instances is resolved once,
+         *  so instantiating the prefab with createEntities() only copies the default values.
+         *  \return the prefab, valid as long as the context
+         */
+        const Prefab& createPrefab(Entity&& prototype)
+        {
+            return parent_.createPrefab(std::move(prototype));
+        }
+
+        /**
+         *  Creates n instances of a prefab, with the same events as createEntities() from a
+         *  prototype entity. The prefab has to be created by this context.
+         *  \return the handles of the new entities, none if the prefab belongs to another context
+         */
+        std::vector<EntityHandle> createEntities(size_t n, const Prefab& prefab)
+        {
+            flushEvents();
+
+            std::vector<EntityHandle> entities = parent_.createEntities(n, prefab);
+            if (!entities.empty()) {
+                for (const ComponentID& cId : prefab.componentIds())
+                    parent_.emitEntityEvents(Event::ENTITYCREATED, cId, entities);
+            }
+            return entities;
+        }
+
+        /**
+         *  Removes entities and all of their components, like removeEntity(). Instead of the
+         *  REMOVED events of the single entity API, one ENTITYREMOVED event per entity and
+         *  component is passed to the interested systems in one batch per component. To keep the
+         *  order of events, the events cached so far are emitted before.
+         */
+        void removeEntities(const std::vector<EntityHandle>& entities)
+        {
+            flushEvents();
+
+            // the removed entities of every observed component
+            IdentifierMap<ComponentID, std::vector<EntityHandle>> removed;
+            for (EntityHandle entity : entities)
+            {
+                const EntityLocation* location = parent_.entityTable_.find(entity);
+                if (location == nullptr) continue;
+                for (const auto& c : location->archetype->signature())
+                {
+                    if (parent_.isObserved(c.first)) removed[c.first].push_back(entity);
+                }
+                for (const auto& pool : parent_.sparsePools_)
+                {
+                    if (pool.second->contains(entity) && parent_.isObserved(pool.first))
+                        removed[pool.first].push_back(entity);
+                }
+                parent_.removeEntity(entity);
+            }
+
+            for (const auto& r : removed)
+                parent_.emitEntityEvents(Event::ENTITYREMOVED, r.first, r.second);
         }
 
         /**
@@ -99,23 +270,37 @@ public:
          */
         void setEntity(const EntityID& eId, Entity&& entity) noexcept
         {
-            Entity& eBefore = parent_.entities_[eId];
+            setEntity(parent_.findOrCreateEntity(eId), std::move(entity));
+        }
+
+        void setEntity(EntityHandle handle, Entity&& entity) noexcept
+        {
+            const EntityLocation* before = parent_.entityTable_.find(handle);
+            if (before == nullptr) return;
+
             // For all components that the old entity had, emit either REMOVED or CHANGED event
-            for (auto& c : eBefore.components_)
-            {
-                if (entity.components_.find(c.first) == entity.components_.end())
-                    eventList_.emplace_back(Event::COMPONENTREMOVED, eId, c.first);
+            auto replaced = [&](const ComponentID& cId) {
+                if (entity.components_.find(cId) == entity.components_.end())
+                    events_.emplace_back(Event::COMPONENTREMOVED, handle, cId);
                 else
-                    eventList_.emplace_back(Event::COMPONENTCHANGED, eId, c.first);
+                    events_.emplace_back(Event::COMPONENTCHANGED, handle, cId);
+            };
+            if (before->archetype != nullptr) {
+                for (const auto& c : before->archetype->signature())
+                    replaced(c.first);
+            }
+            for (const auto& pool : parent_.sparsePools_)
+            {
+                if (pool.second->contains(handle)) replaced(pool.first);
             }
             // For all new components, emit an ADDED event
             for (auto& c : entity.components_)
             {
-                if (eBefore.components_.find(c.first) == eBefore.components_.end())
-                    eventList_.emplace_back(Event::COMPONENTADDED, eId, c.first);
+                if (!parent_.hasComponent(handle, c.first))
+                    events_.emplace_back(Event::COMPONENTADDED, handle, c.first);
             }
 
-            parent_.entities_[eId] = std::move(entity);
+            parent_.setEntity(handle, std::move(entity));
         }
 
         /**
@@ -125,36 +310,229 @@ public:
         template<typename C>
         C* getComponentWritable(const EntityID& eId, const ComponentID& cId)
         {
-            auto& e = parent_.entities_[eId];
-            if (e.components_.find(cId) == e.components_.end()) {
-                return &parent_.getComponent<C>(e, cId);
-                eventList_.emplace_back(Event::COMPONENTCHANGED, eId, cId);
+            return getComponentWritable<C>(parent_.entityTable_.find(eId), cId);
+        }
+
+        template<typename C>
+        C* getComponentWritable(EntityHandle entity, const ComponentID& cId)
+        {
+            C*               component = nullptr;
+            const ChangeTick tick      = parent_.changeTick();
+            if constexpr (is_sparse_component_v<C>) {
+                SparsePool<C>* pool = parent_.findPool<C>(cId);
+                if (pool != nullptr) {
+                    auto found = pool->findWithTick(entity);
+                    component  = found.first;
+                    if (component != nullptr) *found.second = tick;
+                }
             }
             else
-                return nullptr;
+            {
+                const EntityLocation* location = parent_.entityTable_.find(entity);
+                if (location != nullptr && location->archetype != nullptr &&
+                    location->archetype->hasComponent<C>(cId)) {
+                    component = &parent_.getComponent<C>(*location, cId);
+                    location->archetype
+                        ->column(static_cast<size_t>(location->archetype->columnIndex(cId)))
+                        .markChanged(location->row, tick);
+                }
+            }
+
+            if (component != nullptr) events_.emplace_back(Event::COMPONENTCHANGED, entity, cId);
+            return component;
         }
 
+        /**
+         *  Creates or replaces a component of an entity. Entities that do not exist yet are
+         *  created when given by name.
+         */
         template<typename C, typename... Args>
         void emplaceComponent(const EntityID& eId, const ComponentID& cId, Args... args)
         {
-            auto& e = parent_.entities_[eId];
-            if (e.components_.find(cId) == e.components_.end())
-                eventList_.emplace_back(Event::COMPONENTADDED, eId, cId);
+            emplaceComponent<C>(parent_.findOrCreateEntity(eId), cId,
+                                std::forward<Args>(args)...);
+        }
+
+        template<typename C, typename... Args>
+        void emplaceComponent(EntityHandle entity, const ComponentID& cId, Args... args)
+        {
+            if (!parent_.entityTable_.isAlive(entity)) return;
+
+            if (parent_.hasComponent(entity, cId))
+                events_.emplace_back(Event::COMPONENTCHANGED, entity, cId);
             else
-                eventList_.emplace_back(Event::COMPONENTCHANGED, eId, cId);
+                events_.emplace_back(Event::COMPONENTADDED, entity, cId);
+
+            parent_.emplaceComponent<C>(entity, cId, std::forward<Args>(args)...);
+        }
+
+        /**
+         *  Removes a component from an entity. Components stored in sparse sets are removed in
+         *  O(1), other ones move the entity to the archetype without the component.
+         */
+        void removeComponent(const EntityID& eId, const ComponentID& cId)
+        {
+            removeComponent(parent_.entityTable_.find(eId), cId);
+        }
 
-            parent_.emplaceComponent<C>(eId, cId, std::forward<Args>(args)...);
+        void removeComponent(EntityHandle entity, const ComponentID& cId)
+        {
+            if (parent_.entityTable_.isAlive(entity) && parent_.removeComponent(entity, cId))
+                events_.emplace_back(Event::COMPONENTREMOVED, entity, cId);
         }
 
     protected:
-        Context&         parent_;
-        std::list<Event> eventList_;
+        std::vector<Event> events_;
     }; // class ModifyingProxy
 
+    /**
+     *  Records structural changes, i.e. creating and removing entities and adding and removing
+     *  components, to be applied later. Obtained from commands(); every thread records into a
+     *  buffer of its own, so recording from within a parallel each() neither waits for other
+     *  threads nor invalidates the iteration.
+     *
+     *  The commands of all buffers are played back at the end of updateSystems(), with a single
+     *  ModifyingProxy. They are ordered by the job that recorded them: first the ones recorded
+     *  outside of system updates, then the updates of the systems in the order the systems were
+     *  added. Within a job, the chunks of a parallel each() follow in the order of their rows.
+     *  So the result does not depend on which threads ran the jobs.
+     */
+    class CommandBuffer
+    {
+    public:
+        CommandBuffer(const CommandBuffer&) = delete;
+        CommandBuffer& operator=(const CommandBuffer&) = delete;
+
+        /**
+         *  Creates an entity with the components of prototype. If a name is given and an entity
+         *  with that name exists at playback, its components are replaced instead.
+         */
+        void createEntity(Entity&& prototype, const EntityID& eId = EntityID())
+        {
+            Command command(&applyCreateEntity);
+            command.eId       = eId;
+            command.prototype = std::make_unique<Entity>(std::move(prototype));
+            record(std::move(command));
+        }
+
+        /// Removes an entity and all of its components
+        void removeEntity(EntityHandle entity)
+        {
+            Command command(&applyRemoveEntity);
+            command.entity = entity;
+            record(std::move(command));
+        }
+
+        /// Creates or replaces a component of an entity, constructed from args right away
+        template<typename C, typename... Args>
+        void emplaceComponent(EntityHandle entity, const ComponentID& cId, Args&&... args)
+        {
+            Command command(&applyEmplaceComponent<C>);
+            command.entity = entity;
+            command.cId    = cId;
+            command.component =
+                allocateComponent<C>(parent_.memoryResource(), std::forward<Args>(args)...);
+            record(std::move(command));
+        }
+
+        /// Removes a component from an entity
+        void removeComponent(EntityHandle entity, const ComponentID& cId)
+        {
+            Command command(&applyRemoveComponent);
+            command.entity = entity;
+            command.cId    = cId;
+            record(std::move(command));
+        }
+
+        /// number of commands recorded since the last playback
+        size_t size() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return commands_.size();
+        }
+
+    private:
+        friend class Context;
+
+        struct Command
+        {
+            explicit Command(void (*apply_)(ModifyingProxy&, Command&)) : apply(apply_) {}
+
+            void (*apply)(ModifyingProxy& proxy, Command& command);
+            EntityHandle            entity;
+            ComponentID             cId;
+            EntityID                eId;
+            ComponentPtr            component;
+            std::unique_ptr<Entity> prototype;
+        };
+
+        /// consecutive commands recorded by the same job
+        struct Segment
+        {
+            std::vector<uint32_t> key;        ///< orders the playback, see CommandScope
+            uint64_t              scope;      ///< the scope that recorded the commands
+            uint32_t              dispatches; ///< parallel each() calls of the scope before
+            size_t                begin;      ///< index of the first command
+        };
+
+        explicit CommandBuffer(Context& parent) : parent_(parent) {}
+
+        /// appends a command to the segment of the current job
+        void record(Command&& command);
+
+        static void applyCreateEntity(ModifyingProxy& proxy, Command& command)
+        {
+            proxy.setEntity(proxy.createEntity(command.eId), std::move(*command.prototype));
+        }
+
+        static void applyRemoveEntity(ModifyingProxy& proxy, Command& command)
+        {
+            proxy.removeEntity(command.entity);
+        }
+
+        template<typename C>
+        static void applyEmplaceComponent(ModifyingProxy& proxy, Command& command)
+        {
+            proxy.emplaceComponent<C>(command.entity, command.cId,
+                                      std::move(*static_cast<Component<C>&>(*command.component)));
+        }
+
+        static void applyRemoveComponent(ModifyingProxy& proxy, Command& command)
+        {
+            proxy.removeComponent(command.entity, command.cId);
+        }
+
+        Context&             parent_;
+        mutable std::mutex   mutex_; ///< only contended by the playback
+        std::vector<Command> commands_;
+        std::vector<Segment> segments_;
+    }; // class CommandBuffer
+
+    /**
+     *  Execution mode for each()
+     */
+    enum class Execution
+    {
+        Sequential, ///< runs on the calling thread, the returned future is already fulfilled
+        Parallel ///< partitions the matching entities into chunks that are run on the thread pool
+    };
+
 public:
-    Context()  = default;
+    /// Creates a context that runs parallel work on the default thread pool
+    Context() : threadPool_(DefaultThreadPool::getThreadPool()) {}
+    /// Creates a context that runs parallel work on the given thread pool
+    explicit Context(ThreadPool& threadPool) : threadPool_(threadPool) {}
+    /**
+     *  Creates a context that runs parallel work on the given thread pool and takes the memory
+     *  for its component storage from upstream, e.g. a std::pmr::monotonic_buffer_resource over
+     *  a preallocated arena.
+     */
+    Context(ThreadPool& threadPool, std::pmr::memory_resource* upstream)
+        : componentMemory_(upstream), threadPool_(threadPool)
+    {
+    }
     ~Context() = default;
-    // is only default-constructible (at the moment)
+    // cannot be copied or moved (at the moment)
     Context(const Context&) = delete;
     Context(Context&&)      = delete;
     Context& operator=(const Context&) = delete;
@@ -166,13 +544,186 @@ public:
     template<class S, typename... Args>
     void emplaceSystem(Args... args);
 
+    /**
+     *  Calls fn for every entity that has all components in cIds, passing the entity and
+     *  references to the components. Accessing a component through a non-const reference emits
+     *  a COMPONENTCHANGED event.
+     *  The entity is passed as EntityHandle if fn takes one, otherwise as its (possibly empty)
+     *  EntityID.
+     *
+     *  With Execution::Parallel, the matching entities are split into chunks which are processed
+     *  concurrently on the thread pool, so fn has to be safe to call from several threads at
+     *  once. The returned future is fulfilled when all chunks have finished and the context must
+     *  not be structurally changed until then. Record structural changes with commands()
+     *  instead, they are played back at the end of updateSystems().
+     *
+     *  \return a TaskFuture returning the number of processed entities
+     */
     template<typename ArrayN, typename Fn>
-    TaskFuture<size_t> each(ArrayN cIds, Fn fn);
+    TaskFuture<size_t> each(ArrayN cIds, Fn fn, Execution execution = Execution::Sequential);
 
     template<typename ArrayN, typename Fn>
-    TaskFuture<size_t> each(ArrayN cIds, Fn fn) const;
+    TaskFuture<size_t> each(ArrayN cIds, Fn fn,
+                            Execution execution = Execution::Sequential) const;
 
-    TaskFuture<size_t> each(const std::function<void(const EntityID&, Entity&)>&& fn);
+    /**
+     *  Like each() with component IDs, but iterates a query obtained from query(). The
+     *  functor has to take the component types of the query, in the same order.
+     */
+    template<typename... C, typename Fn>
+    TaskFuture<size_t> each(const Query<C...>& query, Fn fn,
+                            Execution execution = Execution::Sequential);
+
+    template<typename... C, typename Fn>
+    TaskFuture<size_t> each(const Query<C...>& query, Fn fn,
+                            Execution execution = Execution::Sequential) const;
+
+    TaskFuture<size_t> each(const std::function<void(const EntityID&, const EntityView&)>&& fn);
+
+    /**
+     *  Like each(), but only visits the entities where at least one of the components was
+     *  written at or after the given change tick, e.g. SystemBase::lastUpdateTick() or a
+     *  changeTick() remembered earlier. Checking the tick of a component is much cheaper than
+     *  processing a COMPONENTCHANGED event, and the system does not need to subscribe to any.
+     *
+     *  Accessing a component through a non-const reference counts as a write, so reactive
+     *  systems should take the components they filter on as const references.
+     */
+    template<typename ArrayN, typename Fn>
+    TaskFuture<size_t> eachChanged(ArrayN cIds, ChangeTick since, Fn fn,
+                                   Execution execution = Execution::Sequential);
+
+    template<typename ArrayN, typename Fn>
+    TaskFuture<size_t> eachChanged(ArrayN cIds, ChangeTick since, Fn fn,
+                                   Execution execution = Execution::Sequential) const;
+
+    template<typename... C, typename Fn>
+    TaskFuture<size_t> eachChanged(const Query<C...>& query, ChangeTick since, Fn fn,
+                                   Execution execution = Execution::Sequential);
+
+    template<typename... C, typename Fn>
+    TaskFuture<size_t> eachChanged(const Query<C...>& query, ChangeTick since, Fn fn,
+                                   Execution execution = Execution::Sequential) const;
+
+    /**
+     *  Like each(), but passes the components of many entities at once, as pointers to
+     *  contiguous arrays, together with their number:
+     *
+     *      context.eachChunk(std::array<ComponentID, 2>{{"Position", "Velocity"}},
+     *                        [](size_t n, Vec3* pos, const Vec3* vel) {
+     *                            for (size_t i = 0; i < n; ++i)
+     *                                pos[i].x += vel[i].x;
+     *                        });
+     *
+     *  fn gets the rows of one archetype in blocks that fit into the L1 cache, so loops over
+     *  them can be vectorized by the compiler. Components that are not const qualified are
+     *  marked as changed for the whole block and emit COMPONENTCHANGED events. Components stored
+     *  in sparse sets are not contiguous and can not be used.
+     */
+    template<typename ArrayN, typename Fn>
+    TaskFuture<size_t> eachChunk(ArrayN cIds, Fn fn, Execution execution = Execution::Sequential);
+
+    template<typename ArrayN, typename Fn>
+    TaskFuture<size_t> eachChunk(ArrayN cIds, Fn fn,
+                                 Execution execution = Execution::Sequential) const;
+
+    template<typename... C, typename Fn>
+    TaskFuture<size_t> eachChunk(const Query<C...>& query, Fn fn,
+                                 Execution execution = Execution::Sequential);
+
+    template<typename... C, typename Fn>
+    TaskFuture<size_t> eachChunk(const Query<C...>& query, Fn fn,
+                                 Execution execution = Execution::Sequential) const;
+
+    /**
+     *  The pool all component storage of the context is allocated from. Standalone entities
+     *  that are built for setEntity() should allocate their components from it as well, so
+     *  that handing them over recycles the memory instead of going through malloc:
+     *
+     *      Entity entity(context.memoryResource());
+     *
+     *  The pool is thread safe.
+     */
+    std::pmr::memory_resource* memoryResource() noexcept { return &componentMemory_; }
+
+    /**
+     *  The current value of the change counter. Every write to a component stores the current
+     *  value next to the component. The counter advances whenever a system finished its update,
+     *  so that the writes afterwards can be told apart from the ones before.
+     */
+    ChangeTick changeTick() const noexcept { return changeTick_.load(std::memory_order_relaxed); }
+
+    /**
+     *  Writes all entities and their components to a compact binary snapshot. The components are
+     *  written column by column, trivially copyable ones as a single blob per column, so writing
+     *  costs about as much as copying the storage. Components without a SnapshotEncoding are
+     *  left out, see component_serializer. Entities keep their handles and names.
+     *
+     *  Takes the same shared lock as the read-only functionals of exec(), so it can run
+     *  concurrently with them, but not with modifications or each().
+     *
+     *  \throw std::runtime_error if the stream fails, the snapshot is incomplete then
+     */
+    void writeSnapshot(std::ostream& out) const;
+
+    /**
+     *  Writes a snapshot to a file, see writeSnapshot(). The snapshot is written to path.tmp
+     *  first and then renamed to path, so an existing file is replaced as a whole: a context
+     *  that mapped it keeps reading the old one, see mapSnapshot(), and a failed write leaves
+     *  it as it was.
+     *
+     *  \throw std::runtime_error if the file can not be written or renamed
+     */
+    void writeSnapshot(const std::string& path) const;
+
+    /**
+     *  Restores the entities and components of a snapshot written by writeSnapshot() into this
+     *  context, which must not have any entities yet. Handles, names and the handles created
+     *  next are the same as in the context that wrote the snapshot. The component types are
+     *  matched by name and size, so they have to be registered already, i.e. have been used with
+     *  componentTypeId(), which every query, each() or Component of them does, or with
+     *  registerComponentTypes() in a process that reads the snapshot first. Components that can
+     *  not be restored, e.g. of unknown types, are skipped and returned. Subscribed systems get
+     *  ENTITYCREATED events for the restored components.
+     *
+     *  Snapshots use the native byte order and layout of the types, they are meant to be read
+     *  by the same build on the same platform.
+     *
+     *  \throw std::runtime_error if the context has entities or the snapshot is not valid. The
+     *         context is left in an unspecified state if the snapshot ends in the middle.
+     *  \return the skipped columns, empty if all components were restored
+     */
+    std::vector<SkippedSnapshotColumn> readSnapshot(std::istream& in);
+
+    /**
+     *  Like readSnapshot(), but maps the snapshot file into memory instead of reading it, which
+     *  must have been written by writeSnapshot() to the start of the file. The archetype
+     *  columns of trivially copyable components use the mapped values as their storage instead
+     *  of copying them, so loading costs little more than rebuilding the entity table.
+     *
+     *  The mapping is private: writing to a component copies its page of the mapping and never
+     *  modifies the file. A column copies its values out of the mapping when it has to grow,
+     *  i.e. when an entity is added to its archetype. The file stays mapped until all columns
+     *  did, or the context is destroyed.
+     *
+     *  Pages that were not written to are read from the file, so it must not be modified while
+     *  it is mapped: truncating it makes reading the components crash with SIGBUS, writing to
+     *  it changes them. To write a checkpoint to the same path, use writeSnapshot(path), which
+     *  replaces the file instead of overwriting it, never a std::ofstream opened on path.
+     *
+     *  \throw std::runtime_error like readSnapshot(), or if the file can not be mapped
+     *  \return the skipped columns like readSnapshot()
+     */
+    std::vector<SkippedSnapshotColumn> mapSnapshot(const std::string& path);
+
+    /**
+     *  Returns the query for all entities that have components of types C with the given IDs,
+     *  registering it on first use. A registered query is told about every new archetype, so
+     *  iterating it only touches the matching archetypes. each() with component IDs uses these
+     *  queries as well, holding on to one merely saves looking it up.
+     */
+    template<typename... C>
+    const Query<C...>& query(const std::array<ComponentID, sizeof...(C)>& cIds) const;
 
     /**
      *  Executes a functional on the context. The parameters of the functional
@@ -182,16 +733,43 @@ public:
      *  The functional is expected to take either a Context::ReadOnlyProxy& or a
      * Context::ModifyingProxy&, currently no other overloads exist.
      *
-     *  \return a TaskFuture returning the result of the functional.
+     *  Read-only functionals run on the thread pool and hold a shared lock on the context, so
+     *  any number of them run concurrently. Modifying functionals are queued and applied at the
+     *  next tick boundary, i.e. at the start and the end of updateSystems(), or as soon as their
+     *  future is waited for, whichever comes first. All queued ones are applied in the order
+     *  they were queued, under an exclusive lock. The locks are not recursive, so a functional
+     *  must not wait for the future of another one. each() does not take the lock, the context
+     *  must not be modified while it runs.
+     *
+     *  While updateSystems() updates the systems, which iterate the context without the lock,
+     *  waiting does not apply the functionals but blocks until the end of the tick. From within
+     *  a system update, get() throws a std::logic_error instead, since the tick can not end
+     *  while it waits, and an uncaptured future does not block.
+     *
+     *  \return a pending TaskFuture returning the result of the functional, or rethrowing the
+     *          exception it threw.
      *  \note If you don't capture the returned future, this will block until the functional has
      *          been scheduled and excuted by the context, essentially turning this into a
-     *          synchronous operation on the calling thread.
+     *          synchronous operation on the calling thread. Detach the future to let a modifying
+     *          functional be applied at the next tick boundary without waiting for it.
      */
     template<typename Fn>
     TaskFuture<typename function_traits<Fn>::result_type> exec(Fn&& fn);
 
     /**
-     *	Calls update() on all registered systems.
+     *  [Threadsafe] Returns the command buffer of the calling thread, to create and remove
+     *  entities and components from within each() or a system update. The commands are played
+     *  back at the end of updateSystems(), see CommandBuffer.
+     */
+    CommandBuffer& commands();
+
+    /**
+     *	Calls update() on all registered systems that are invalid.
+     *
+     *  Systems that conflict in their component access (see SystemBase::declareReads()) are
+     *  updated in the order they were added, all others are updated concurrently on the thread
+     *  pool. Blocks until all systems are updated. If an update throws, the remaining systems are
+     *  still updated and the first exception is rethrown afterwards.
      */
     void updateSystems();
 
@@ -208,65 +786,644 @@ public:
     }
 
 private:
-    mutable std::unordered_map<EntityID, Entity>
-                                             entities_; // mutable so we can still get const refs out from a const Context
-    std::vector<std::unique_ptr<SystemBase>> systems_;
+    /// pools the component storage by size class, declared first so that it is destroyed last
+    std::pmr::synchronized_pool_resource componentMemory_;
+
+    std::vector<std::unique_ptr<Archetype>> archetypes_;
+    /// archetypes by the key of their signature, see Archetype::key()
+    std::map<Archetype::Key, Archetype*> archetypeLookup_;
+    /// registered queries, by their component IDs and types in query order
+    mutable std::map<Archetype::Key, std::unique_ptr<QueryBase>> queries_;
+    /// guards queries_ and the creation of archetypes, queries are registered by const each()
+    mutable std::mutex queryMutex_;
+    /// shared by the functionals of exec() taking a ReadOnlyProxy, exclusive to ModifyingProxy
+    mutable std::shared_mutex proxyMutex_;
+    /// set while updateSystems() updates the systems, guarded by proxyMutex_
+    bool ticking_ = false;
+
+    /**
+     *  A functional of exec() taking a ModifyingProxy, queued until it is applied.
+     */
+    class PendingModificationBase
+    {
+    public:
+        virtual ~PendingModificationBase() {}
+
+        /// runs the functional, keeping its result or exception
+        virtual void run(ModifyingProxy& proxy) noexcept = 0;
+
+        /// passes the result or exception to the future
+        virtual void fulfill() = 0;
+    };
+
+    template<typename ReturnType, typename Fn>
+    class PendingModification : public PendingModificationBase
+    {
+    public:
+        explicit PendingModification(const Fn& fn) : fn_(fn) {}
+
+        std::future<ReturnType> getFuture() { return promise_.get_future(); }
+
+        void run(ModifyingProxy& proxy) noexcept override
+        {
+            try
+            {
+                if constexpr (std::is_void<ReturnType>::value)
+                    fn_(proxy);
+                else
+                    result_.emplace(fn_(proxy));
+            }
+            catch (...)
+            {
+                error_ = std::current_exception();
+            }
+        }
+
+        void fulfill() override
+        {
+            if (error_) {
+                promise_.set_exception(error_);
+                return;
+            }
+            if constexpr (std::is_void<ReturnType>::value)
+                promise_.set_value();
+            else
+                promise_.set_value(std::move(*result_));
+        }
+
+    private:
+        /// the result of the functional, if it returns one
+        using Result = std::conditional_t<std::is_void<ReturnType>::value, bool,
+                                          std::optional<ReturnType>>;
+
+        Fn                       fn_;
+        std::promise<ReturnType> promise_;
+        Result                   result_{};
+        std::exception_ptr       error_;
+    };
+
+    /// guards pendingModifications_
+    std::mutex                                            pendingMutex_;
+    std::vector<std::unique_ptr<PendingModificationBase>> pendingModifications_;
+
+    /**
+     *  The job recording commands on the current thread: the update of a system, a chunk of a
+     *  parallel each() or, outside of them, the thread itself. A job is identified by the path
+     *  of indices leading to it, which orders the playback of the commands it recorded.
+     */
+    class CommandScope
+    {
+    public:
+        /// enters the scope on the current thread, the previous one is restored on destruction
+        explicit CommandScope(std::vector<uint32_t>&& key);
+        ~CommandScope() { top() = previous_; }
+
+        CommandScope(const CommandScope&) = delete;
+        CommandScope& operator=(const CommandScope&) = delete;
+
+        /// the innermost scope of the current thread
+        static CommandScope& current();
+
+        /// reserves the key of a parallel each(), its chunks append their index
+        std::vector<uint32_t> dispatchKey();
+
+        /// the key of the commands this scope records from now on
+        std::vector<uint32_t> ownKey() const;
+
+        /// whether the scope is a system update or a chunk dispatched by one
+        bool inSystemUpdate() const noexcept { return key_.front() == 1; }
+
+        uint64_t id() const noexcept { return id_; }
+        uint32_t dispatches() const noexcept { return dispatches_; }
+
+    private:
+        static CommandScope*& top();
+
+        std::vector<uint32_t> key_;
+        uint64_t              id_;
+        uint32_t              dispatches_ = 0;
+        CommandScope*         previous_;
+    };
+
+    /// identifies the context in the per-thread cache of commands()
+    const uint64_t contextId_ = nextContextId();
+    /// guards commandBuffers_
+    std::mutex commandBuffersMutex_;
+    /// the command buffers of all threads that recorded commands, in the order of their creation
+    std::vector<std::pair<std::thread::id, std::unique_ptr<CommandBuffer>>> commandBuffers_;
+
+    static uint64_t nextContextId()
+    {
+        static std::atomic<uint64_t> next{1};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::vector<std::unique_ptr<Prefab>>       prefabs_;
+    EntityTable                                entityTable_;
+    std::vector<std::unique_ptr<SystemBase>>   systems_;
+    ThreadPool&                                threadPool_;
+    std::atomic<ChangeTick>                    changeTick_{1}; ///< see changeTick()
+
+    /// sparse sets of the components whose type is stored in sparse sets, by ComponentID
+    IdentifierMap<ComponentID, std::unique_ptr<SparsePoolBase>> sparsePools_;
+
+    /// dependencies between systems, indexed like systems_
+    struct SystemNode
+    {
+        std::vector<size_t> predecessors; ///< earlier systems that conflict with this one
+        std::vector<size_t> successors;   ///< later systems that conflict with this one
+    };
+    std::vector<SystemNode> systemGraph_;
+
+    /// bookkeeping for one concurrent updateSystems() call
+    struct SystemUpdateState
+    {
+        explicit SystemUpdateState(size_t nSystems)
+            : scheduled(nSystems, false), pending(new std::atomic<size_t>[nSystems])
+        {
+        }
+
+        std::vector<bool>                      scheduled; ///< systems updated in this tick
+        std::unique_ptr<std::atomic<size_t>[]> pending;   ///< unfinished predecessors
+        std::atomic<size_t>                    remaining{0};
+        std::promise<void>                     done;
+        std::mutex                             errorMutex;
+        std::exception_ptr                     error;
+    };
+
+    /// first bytes of every snapshot, the last two are the version of the format
+    static constexpr char snapshotMagic[8] = {'T', 'X', 'S', 'N', 'A', 'P', '0', '2'};
+    /// alignment of the values of trivially copyable components in snapshots, for mapSnapshot()
+    static constexpr size_t snapshotAlignment = 64;
+    /// written after snapshotMagic, reads differently on platforms with another byte order
+    static constexpr uint32_t snapshotByteOrder = 0x01020304;
+
+    /// number of components of an event batch that internComponents() searches linearly
+    static constexpr size_t internLinearLimit = 8;
+    /// minimum number of entities processed by one task of a parallel each()
+    static constexpr size_t minEachChunkSize = 256;
+    /// size of the blocks of rows passed to the functor of eachChunk(), a share of the L1 cache
+    static constexpr size_t eachChunkBytes = 16 * 1024;
+    /// minimum number of rows of a block of eachChunk(), for components larger than a block
+    static constexpr size_t eachChunkMinRows = 16;
+
+    /// systems that subscribed to the events of a component, see SystemBase::declareInterest()
+    IdentifierMap<ComponentID, std::vector<SystemBase*>> componentSubscribers_;
+    /// systems without subscriptions, they are asked about every component event
+    std::vector<SystemBase*> componentWildcards_;
+    /// systems interested in the SYSTEMUPDATED events of a system, see SystemBase::isInterested()
+    IdentifierMap<SystemID, std::vector<SystemBase*>> systemSubscribers_;
 
     /**
      *  [Threadsafe] Puts an event onto the event bus to be consumed by the systems.
      *
      *  Enqueues an event in all system queues that are interested.
      */
-    void emitEvent(const Event& event);
+    void emitEvent(const Event& event) const;
 
     /**
-     *	Returns an entity with the specified eId. If none exists, a new one will be created.
+     *  [Threadsafe] Emits a batch of component events. Repeated events about the same component
+     *  of an entity are dropped, the others are grouped by component and every group is passed
+     *  to the subscribed systems at once. Leaves events in an unspecified order.
      */
-    Entity& getEntity(const EntityID& eId) noexcept;
+    void emitEvents(std::vector<Event>& events) const;
 
     /**
-     *	Returns an entity with the specified eId. If none exists, a new one will be created.
+     *  [Threadsafe] Passes events [first, last), which are all about component cId, to the
+     *  interested systems.
      */
-    const Entity& getEntity(const EntityID& eId) const noexcept;
+    void emitComponentEvents(const ComponentID& cId, const Event* first, const Event* last) const;
 
     /**
-     *  Sets/replaces an entity
+     *  [Threadsafe] Passes one event of the given type about component cId for each of the
+     *  entities to the interested systems, at once.
      */
-    void setEntity(const EntityID& eId, Entity&& entity) noexcept;
+    void emitEntityEvents(Event::EventType type, const ComponentID& cId,
+                          const std::vector<EntityHandle>& entities) const;
 
+    /**
+     *  Whether any system might be interested in events about the given component. If not,
+     *  callers can skip creating the events.
+     */
+    bool isObserved(const ComponentID& cId) const
+    {
+        return !componentWildcards_.empty() || componentSubscribers_.count(cId) > 0;
+    }
+
+    /**
+     *  Interns the components of a batch of events to dense indices, in the order they first
+     *  appear, so that the batch can be sorted and grouped by integer keys.
+     *  \return the index of the component of every event
+     */
+    static std::vector<uint32_t> internComponents(const std::vector<Event>&  events,
+                                                  std::vector<ComponentID>& components);
+
+    /**
+     *  Removes repeated events about the same component of an entity from a batch, keeping the
+     *  order of the remaining events and of their indices from internComponents().
+     */
+    static void deduplicateEvents(std::vector<Event>& events, std::vector<uint32_t>& indices);
+
+    /// a column of a snapshot, see readSnapshotSchema()
+    struct SnapshotColumn
+    {
+        ComponentID     cId;
+        std::string     typeName;
+        ComponentTypeID typeId = 0;
+        bool            known  = false; ///< whether the type is registered with the same layout
+    };
+
+    /**
+     *  Writes the ID and the type of a column to a snapshot. The type is written by name and
+     *  size, ComponentTypeIDs depend on the order the types were registered in.
+     */
+    static void writeSnapshotSchema(std::ostream& out, const ComponentID& cId,
+                                    ComponentTypeID typeId);
+
+    /**
+     *  Reads a column written by writeSnapshotSchema() and looks up its type.
+     */
+    static SnapshotColumn readSnapshotSchema(std::istream& in);
+
+    /**
+     *  Writes the values of a column or sparse set to a snapshot, preceded by their size in
+     *  bytes so that readers can skip them. Trivially copyable values are padded to
+     *  snapshotAlignment relative to start, the position of the snapshot in the stream, if the
+     *  stream can tell its position.
+     */
+    template<typename Storage>
+    static void writeSnapshotValues(std::ostream& out, std::streampos start,
+                                    const Storage& storage);
+
+    /**
+     *  Reads the size and padding of values written by writeSnapshotValues() for n components
+     *  of the given column. Skips the values and returns false if they can not be read.
+     */
+    static bool beginSnapshotValues(std::istream& in, const SnapshotColumn& column, size_t n);
+
+    /**
+     *  Reads a snapshot, see readSnapshot(). If the stream reads from mapping, the archetype
+     *  columns adopt the mapped values instead of reading them, see mapSnapshot().
+     */
+    std::vector<SkippedSnapshotColumn>
+    readSnapshot(std::istream& in, const std::shared_ptr<detail::MappedSnapshot>& mapping);
+
+    /**
+     *  Runs a functional of exec() that takes a proxy of type Proxy, see exec().
+     */
+    template<typename ReturnType, typename Proxy, typename Fn>
+    TaskFuture<ReturnType> execWith(const Fn& fn);
+
+    /**
+     *  Applies all queued modifying functionals of exec() with a single proxy and fulfills
+     *  their futures.
+     *
+     *  \param waiting whether it is called for a future that is waited for. While systems are
+     *         updated, such calls leave the functionals to the end of the tick, or throw a
+     *         std::logic_error if they come from a system update, which would never end.
+     *  \return false if there were none, or they were left to the end of the tick
+     */
+    bool applyModifications(bool waiting = false);
+
+    /**
+     *  Plays back the commands of all command buffers, see CommandBuffer.
+     *  \return false if no commands were recorded
+     */
+    bool playbackCommands();
+
+    /**
+     *  Sets ticking_ under the exclusive lock, so that no waiting thread is applying
+     *  modifications when the systems start to be updated.
+     */
+    void setTicking(bool ticking);
+
+    /**
+     *  Updates the scheduled systems on the thread pool, each one once its conflicting
+     *  predecessors are done. Rethrows the first exception of an update after all of them.
+     */
+    void updateSystemsConcurrently(const std::vector<size_t>& scheduled);
+
+    /**
+     *  Updates the system with the given index and emits its SYSTEMUPDATED event. The commands
+     *  recorded by the update are played back in the order of the index.
+     */
+    void updateSystem(size_t index);
+
+    /**
+     *  Updates a system as part of a concurrent updateSystems() call, then schedules all
+     *  successors that have no unfinished predecessors left.
+     */
+    void updateSystem(size_t index, const std::shared_ptr<SystemUpdateState>& state);
+
+    /**
+     *	Returns a view of the given entity. If it does not exist, the view is invalid.
+     */
+    EntityView getEntity(EntityHandle entity) const noexcept;
+
+    /**
+     *  Creates an entity without components, optionally with a name that is not in use yet.
+     */
+    EntityHandle createEntity(const EntityID& eId);
+
+    /**
+     *  Looks up an entity by name, creating it without components if there is none. Like all
+     *  entities, a new one is placed in the empty archetype until it gets components.
+     */
+    EntityHandle findOrCreateEntity(const EntityID& eId);
+
+    /**
+     *  The archetype of entities without components, or only with ones in sparse sets.
+     */
+    Archetype& emptyArchetype();
+
+    /**
+     *  Creates n entities with copies of the components of prototype.
+     */
+    std::vector<EntityHandle> createEntities(size_t n, const Entity& prototype);
+
+    /**
+     *  Creates n instances of a prefab.
+     */
+    std::vector<EntityHandle> createEntities(size_t n, const Prefab& prefab);
+
+    /**
+     *  Creates n entities in an archetype. The caller has to append n values to every column.
+     */
+    std::vector<EntityHandle> appendEntities(Archetype& archetype, size_t n);
+
+    /**
+     *  Registers a template entity, see ModifyingProxy::createPrefab().
+     */
+    const Prefab& createPrefab(Entity&& prototype);
+
+    /**
+     *  Returns the sparse set for a component of the given type, creating it if it does not
+     *  exist yet. Returns nullptr if the component is already stored in a set of another type.
+     */
+    SparsePoolBase* getPool(const ComponentID& cId, ComponentTypeID typeId);
+
+    /**
+     *  The archetype storing the components of the entity that are not stored in sparse sets.
+     */
+    Archetype& getArchetype(const Entity& entity);
+
+    /**
+     *  Removes an entity and all of its components.
+     */
+    void removeEntity(EntityHandle entity);
+
+    /**
+     *  Returns the archetype for the given signature, creating it if it does not exist yet.
+     *  makeColumn(signatureEntry) is called to create the empty columns for a new archetype.
+     */
+    template<typename ColumnFactory>
+    Archetype& getArchetype(Archetype::Signature&& signature, ColumnFactory makeColumn);
+
+    /**
+     *  Removes a row from an archetype and updates the location of the entity moved into its
+     *  place.
+     */
+    void removeRow(Archetype& archetype, size_t row);
+
+    /**
+     *  Sets/replaces an entity, moving its components into the archetype storage
+     */
+    void setEntity(EntityHandle handle, Entity&& entity) noexcept;
+
+    /**
+     *  Creates or replaces a component of an existing entity, moving the entity to the matching
+     *  archetype if necessary.
+     */
     template<typename C, typename... Args>
-    void emplaceComponent(const EntityID& eId, const ComponentID& cId, Args... args);
+    void emplaceComponent(EntityHandle entity, const ComponentID& cId, Args... args);
 
     template<typename C>
-    void setComponent(const EntityID& eId, const ComponentID& cId,
-                      std::unique_ptr<Component<C>> component);
+    void setComponent(EntityHandle entity, const ComponentID& cId, C&& componentData);
 
     template<typename... ComponentTypes>
-    void setComponent(const EntityID& eId,
+    void setComponent(EntityHandle entity,
                       const std::pair<ComponentID, ComponentTypes>&... cIDValues);
 
     /**
-     *  Returns the component of an entity. If either entity or component do not exist,
-     *  an instance is created using default constructor.
+     *  Copies the component of an entity into componentData.
+     *  \return false if either entity or component do not exist or if the type does not match.
      */
     template<typename C>
-    bool getComponent(const EntityID& eId, const ComponentID& cId, C& componentData) const;
+    bool getComponent(EntityHandle entity, const ComponentID& cId, C& componentData) const;
 
     /**
-     *  Returns the component of an entity. If it either entity or component do not exist,
-     *  an instance is created using default constructor.
+     *  Returns the component of an entity. The component has to exist.
      */
     template<typename ComponentType>
-    ComponentType& getComponent(Entity& e, const ComponentID& cId) const;
+    ComponentType& getComponent(const EntityLocation& location, const ComponentID& cId) const;
 
     /**
-     *	Convenience function to extract all components for an entity and pass them to the given
-     *functional. Will generate COMPONENTCHANGED events for all components that are not accessed as
-     *refs to const.
+     *  Whether an existing entity has a component with the given ID, in either storage.
      */
-    template<typename... C, typename Fn, size_t N, size_t... CIndices, typename... FuncArgs>
-    void callFuncWithComponents(Fn fn, const EntityID& eId, const std::array<ComponentID, N>& cIds,
-                                std::index_sequence<CIndices...>, FuncArgs... funcArgs);
+    bool hasComponent(EntityHandle entity, const ComponentID& cId) const;
+
+    /**
+     *  Removes a component from an existing entity.
+     *  \return whether the entity had the component
+     */
+    bool removeComponent(EntityHandle entity, const ComponentID& cId);
+
+    /**
+     *  Returns the sparse set of a component, or nullptr if no entity ever had it.
+     */
+    template<typename C>
+    SparsePool<C>* findPool(const ComponentID& cId) const;
+
+    /**
+     *  Returns the sparse set of a component, creating it if it does not exist yet.
+     */
+    template<typename C>
+    SparsePool<C>& getPool(const ComponentID& cId);
+
+    /**
+     *  Finds a component of type C of an entity in the storage of C. Used by each() to look up
+     *  the components of the entities of a sparse set.
+     */
+    template<typename C, bool Sparse = is_sparse_component_v<C>>
+    class ComponentLocator;
+
+    template<typename C>
+    class ComponentLocator<C, true>
+    {
+    public:
+        ComponentLocator(const Context& c, const ComponentID& cId) : pool_(c.findPool<C>(cId)) {}
+
+        /// the component and its change tick, or nullptrs if the entity has none
+        std::pair<C*, ChangeTick*> find(EntityHandle entity) const noexcept
+        {
+            if (pool_ == nullptr) return {nullptr, nullptr};
+            return pool_->findWithTick(entity);
+        }
+
+    private:
+        SparsePool<C>* pool_;
+    };
+
+    template<typename C>
+    class ComponentLocator<C, false>
+    {
+    public:
+        ComponentLocator(const Context& c, const ComponentID& cId)
+            : entityTable_(c.entityTable_), cId_(cId)
+        {
+        }
+
+        std::pair<C*, ChangeTick*> find(EntityHandle entity) noexcept
+        {
+            const EntityLocation* location = entityTable_.find(entity);
+            if (location == nullptr) return {nullptr, nullptr};
+            // entities of the same archetype tend to be next to each other
+            if (location->archetype != archetype_) {
+                archetype_ = location->archetype;
+                column_    = archetype_ != nullptr && archetype_->hasComponent<C>(cId_)
+                              ? &archetype_->column<C>(
+                                    static_cast<size_t>(archetype_->columnIndex(cId_)))
+                              : nullptr;
+            }
+            if (column_ == nullptr) return {nullptr, nullptr};
+            return {&(*column_)[location->row], column_->ticks() + location->row};
+        }
+
+    private:
+        const EntityTable&  entityTable_;
+        ComponentID         cId_;
+        Archetype*          archetype_ = nullptr;
+        ComponentColumn<C>* column_    = nullptr;
+    };
+
+    /**
+     *  Collects the COMPONENTCHANGED events of each() for all components that are not const
+     *  qualified in the function argument list, and emits them per component at once.
+     *  Components that no system observes are skipped.
+     */
+    template<typename... C>
+    class ChangedEvents
+    {
+    public:
+        static constexpr size_t N = sizeof...(C);
+
+        ChangedEvents(const Context& c, const std::array<ComponentID, N>& cIds, size_t expected)
+            : context_(c), cIds_(cIds)
+        {
+            const std::array<bool, N> writable{
+                {!std::is_const<std::remove_reference_t<C>>::value...}};
+            for (size_t i = 0; i < N; ++i)
+            {
+                record_[i] = writable[i] && c.isObserved(cIds[i]);
+                if (record_[i]) events_[i].reserve(expected);
+            }
+        }
+
+        /// whether events are recorded for any of the components
+        bool recording() const noexcept
+        {
+            return std::find(record_.begin(), record_.end(), true) != record_.end();
+        }
+
+        /// records that the components of an entity were accessed
+        void add(EntityHandle entity)
+        {
+            for (size_t i = 0; i < N; ++i)
+                if (record_[i]) events_[i].emplace_back(Event::COMPONENTCHANGED, entity, cIds_[i]);
+        }
+
+        void flush() const
+        {
+            for (size_t i = 0; i < N; ++i)
+            {
+                const Event* first = events_[i].data();
+                if (record_[i])
+                    context_.emitComponentEvents(cIds_[i], first, first + events_[i].size());
+            }
+        }
+
+    private:
+        const Context&                    context_;
+        const std::array<ComponentID, N>& cIds_;
+        std::array<bool, N>               record_;
+        std::array<std::vector<Event>, N> events_;
+    };
+
+    /**
+     *	Convenience function to extract the component columns of an archetype and pass the
+     *components of every entity to the given functional, iterating the columns linearly. Will
+     *generate COMPONENTCHANGED events and update the change ticks for all components that are not
+     *accessed as refs to const. If since is not 0, rows without a component written at or after
+     *since are skipped.
+     */
+    template<typename... C, typename Fn, typename ArchetypeT, size_t N, size_t... CIndices>
+    size_t callFuncWithComponents(Fn& fn, ArchetypeT& archetype,
+                                  const std::array<ComponentID, N>& cIds,
+                                  std::index_sequence<CIndices...>, size_t beginRow,
+                                  size_t endRow, ChangeTick since) const;
+
+    /**
+     *  Passes rows [beginRow, endRow) of an archetype to fn in blocks, as pointers P to the
+     *  components of the first row of the block. Marks the components accessed through pointers
+     *  to non-const as changed.
+     */
+    template<typename... P, typename Fn, typename ArchetypeT, size_t N, size_t... CIndices>
+    size_t callFuncWithChunks(Fn& fn, ArchetypeT& archetype,
+                              const std::array<ComponentID, N>& cIds,
+                              std::index_sequence<CIndices...>, size_t beginRow,
+                              size_t endRow) const;
+
+    /**
+     *  Like callFuncWithComponents(), but for the entities of rows [beginRow, endRow) of a
+     *  sparse set. All components are looked up per entity, entities that miss one are skipped.
+     */
+    template<typename... C, typename Fn, size_t N, size_t... CIndices>
+    size_t callFuncWithSparseComponents(Fn& fn, const SparsePoolBase& pool,
+                                        const std::array<ComponentID, N>& cIds,
+                                        std::index_sequence<CIndices...>, size_t beginRow,
+                                        size_t endRow, ChangeTick since) const;
+
+    /**
+     *  Returns the smallest sparse set of the components C that are stored in sparse sets, or
+     *  nullptr if one of them has none. each() iterates it instead of the archetypes.
+     */
+    template<typename... C, size_t N, size_t... CIndices>
+    const SparsePoolBase* smallestPool(const std::array<ComponentID, N>& cIds,
+                                       std::index_sequence<CIndices...>) const;
+
+    /**
+     *  Runs fn for all entities of the given (matching) archetypes or the given sparse set,
+     *  either on the calling thread or in chunks on the thread pool. See
+     *  callFuncWithComponents() for since.
+     */
+    template<typename... C, typename Fn, typename ArchetypeT, size_t N>
+    TaskFuture<size_t> dispatchEach(const std::vector<ArchetypeT*>& sources,
+                                    const std::array<ComponentID, N>& cIds, Fn fn,
+                                    Execution execution, ChangeTick since) const;
+
+    /**
+     *  Runs fn for the blocks of rows of the given archetypes, see callFuncWithChunks().
+     */
+    template<typename... P, typename Fn, typename ArchetypeT, size_t N>
+    TaskFuture<size_t> dispatchEachChunk(const std::vector<ArchetypeT*>& sources,
+                                         const std::array<ComponentID, N>& cIds, Fn fn,
+                                         Execution execution) const;
+
+    /**
+     *  Calls run(fn, source, beginRow, endRow), which returns the number of visited entities,
+     *  for all rows of the sources, either on the calling thread or in chunks on the thread
+     *  pool.
+     */
+    template<typename Fn, typename ArchetypeT, typename Run>
+    TaskFuture<size_t> dispatchRows(const std::vector<ArchetypeT*>& sources, Fn fn,
+                                    Execution execution, Run run) const;
+
+    /**
+     *  Runs fn for all entities that have all components C, some of which are stored in sparse
+     *  sets, by iterating the smallest of their sparse sets.
+     */
+    template<typename... C, typename Fn, size_t N>
+    TaskFuture<size_t> dispatchSparseEach(const std::array<ComponentID, N>& cIds, Fn fn,
+                                          Execution execution, ChangeTick since) const;
 
     /// helper functions and structs for variadic implementation
 
@@ -285,34 +1442,36 @@ private:
          *  Implements each() with an array of known component types and a functional type FFn
          */
         template<typename FFn>
-        static tx::TaskFuture<size_t> impl(Context& c, std::array<ComponentID, N> cIds, FFn fn)
+        static tx::TaskFuture<size_t> impl(Context& c, std::array<ComponentID, N> cIds, FFn fn,
+                                           Execution execution, ChangeTick since)
         {
-            std::promise<size_t> pr;
+            return impl(c, c.query<component_value_t<ComponentArgs>...>(cIds), std::move(fn),
+                        execution, since);
+        }
 
+        /**
+         *  Implements each() with a query and a functional type FFn
+         */
+        template<typename FFn, typename... C>
+        static tx::TaskFuture<size_t> impl(Context& c, const Query<C...>& query, FFn fn,
+                                           Execution execution, ChangeTick since)
+        {
             // Check the number of components and IDs
             static_assert(sizeof...(ComponentArgs) == N,
                           "Number of Component IDs does not match functor signature!");
             // check the functor signature
             static_assert(all_true<std::is_reference<ComponentArgs>::value...>::value,
                           "Components can only be accessed through references!");
-            // static_assert(all_true<std::is_base_of<ComponentBase, typename
-            // std::remove_reference<C>::type>::value...>::value, "Functor signature must only
-            // contain Components (derived from ComponentBase)!");
+            static_assert(
+                all_true<std::is_same<C, component_value_t<ComponentArgs>>::value...>::value,
+                "Component types of the query do not match functor signature!");
 
-            const auto aspect = Aspect<ComponentArgs...>(cIds);
-
-            size_t n = 0;
-            for (auto& e : c.entities_)
-            {
-                if (aspect.checkAspect(e.second)) {
-                    c.callFuncWithComponents<ComponentArgs...>(
-                        fn, e.first, cIds, std::make_index_sequence<N>{}, e.first);
-                    ++n;
-                }
+            if constexpr ((is_sparse_component_v<ComponentArgs> || ...)) {
+                return c.dispatchSparseEach<ComponentArgs...>(query.ids(), std::move(fn),
+                                                              execution, since);
             }
-
-            pr.set_value(n);
-            return pr.get_future();
+            return c.dispatchEach<ComponentArgs...>(query.archetypes(), query.ids(),
+                                                    std::move(fn), execution, since);
         }
 
         /**
@@ -321,71 +1480,119 @@ private:
          */
         template<typename FFn>
         static tx::TaskFuture<size_t> impl_const(const Context& c, std::array<ComponentID, N> cIds,
-                                                 FFn fn)
+                                                 FFn fn, Execution execution, ChangeTick since)
         {
-            std::promise<size_t> pr;
+            return impl_const(c, c.query<component_value_t<ComponentArgs>...>(cIds),
+                              std::move(fn), execution, since);
+        }
 
+        /**
+         *  Implements each() with a query and a functional type FFn, const version
+         */
+        template<typename FFn, typename... C>
+        static tx::TaskFuture<size_t> impl_const(const Context& c, const Query<C...>& query,
+                                                 FFn fn, Execution execution, ChangeTick since)
+        {
             // Check the number of components and IDs
             static_assert(sizeof...(ComponentArgs) == N,
                           "Number of Component IDs does not match functor signature!");
             // check the functor signature
             static_assert(all_true<std::is_reference<ComponentArgs>::value...>::value,
                           "Components can only be accessed through references!");
-            static_assert(all_true<std::is_const<ComponentArgs>::value...>::value,
-                          "Const version can only access const references!");
-            // static_assert(all_true<std::is_base_of<ComponentBase, typename
-            // std::remove_reference<C>::type>::value...>::value, "Functor signature must only
-            // contain Components (derived from ComponentBase)!");
-
-            const auto aspect = Aspect<ComponentArgs...>(cIds);
+            static_assert(
+                all_true<std::is_const<std::remove_reference_t<ComponentArgs>>::value...>::value,
+                "Const version can only access const references!");
+            static_assert(
+                all_true<std::is_same<C, component_value_t<ComponentArgs>>::value...>::value,
+                "Component types of the query do not match functor signature!");
 
-            size_t n = 0;
-            for (auto& e : c.entities_)
-            {
-                if (aspect.checkAspect(e.second)) {
-                    c.callFuncWithComponents<ComponentArgs...>(
-                        fn, e.first, cIds, std::make_index_sequence<N>{}, e.first);
-                    ++n;
-                }
+            if constexpr ((is_sparse_component_v<ComponentArgs> || ...)) {
+                return c.dispatchSparseEach<ComponentArgs...>(query.ids(), std::move(fn),
+                                                              execution, since);
             }
-
-            pr.set_value(n);
-            return pr.get_future();
+            return c.dispatchEach<ComponentArgs...>(query.archetypes(), query.ids(),
+                                                    std::move(fn), execution, since);
         }
     };
 
-    template<typename Fn>
-    struct exec_variadic_impl : public exec_variadic_impl<decltype(&Fn::operator())>
+    template<typename ArrayN, typename Fn>
+    struct each_chunk_variadic_impl
+        : public each_chunk_variadic_impl<ArrayN, decltype(&Fn::operator())>
     {
     };
 
-    // partial specialization of exec() for void-returning functionals
-    template<typename ClassType, typename FirstArgType>
-    struct exec_variadic_impl<void (ClassType::*)(FirstArgType&) const>
+    // partial specialization of eachChunk() w.r.t. the lambda function as a struct
+    template<size_t N, typename ClassType, typename ReturnType, typename... ComponentArgs>
+    struct each_chunk_variadic_impl<std::array<ComponentID, N>,
+                                    ReturnType (ClassType::*)(size_t, ComponentArgs...) const>
     {
-        template<typename Fn>
-        static TaskFuture<void> impl(Context& c, const Fn& fn)
+        /// the plain component type of a pointer argument
+        template<typename P>
+        using value_t = std::remove_cv_t<std::remove_pointer_t<P>>;
+
+        template<typename FFn>
+        static tx::TaskFuture<size_t> impl(Context& c, std::array<ComponentID, N> cIds, FFn fn,
+                                           Execution execution)
+        {
+            return impl(c, c.query<value_t<ComponentArgs>...>(cIds), std::move(fn), execution);
+        }
+
+        template<typename FFn, typename... C>
+        static tx::TaskFuture<size_t> impl(Context& c, const Query<C...>& query, FFn fn,
+                                           Execution execution)
         {
-            // TODO: acquire read-only lock on the whole context
-            std::promise<void> pr;
-            FirstArgType       proxy(c);
-            fn(proxy);
-            pr.set_value();
-            return pr.get_future();
+            checkSignature<C...>();
+            return c.dispatchEachChunk<ComponentArgs...>(query.archetypes(), query.ids(),
+                                                         std::move(fn), execution);
+        }
+
+        template<typename FFn>
+        static tx::TaskFuture<size_t> impl_const(const Context& c, std::array<ComponentID, N> cIds,
+                                                 FFn fn, Execution execution)
+        {
+            return impl_const(c, c.query<value_t<ComponentArgs>...>(cIds), std::move(fn),
+                              execution);
+        }
+
+        template<typename FFn, typename... C>
+        static tx::TaskFuture<size_t> impl_const(const Context& c, const Query<C...>& query,
+                                                 FFn fn, Execution execution)
+        {
+            checkSignature<C...>();
+            static_assert(
+                all_true<std::is_const<std::remove_pointer_t<ComponentArgs>>::value...>::value,
+                "Const version can only access pointers to const!");
+            return c.dispatchEachChunk<ComponentArgs...>(query.archetypes(), query.ids(),
+                                                         std::move(fn), execution);
+        }
+
+        template<typename... C>
+        static constexpr void checkSignature()
+        {
+            static_assert(sizeof...(ComponentArgs) == N,
+                          "Number of Component IDs does not match functor signature!");
+            static_assert(all_true<std::is_pointer<ComponentArgs>::value...>::value,
+                          "Blocks of components can only be accessed through pointers!");
+            static_assert(all_true<std::is_same<C, value_t<ComponentArgs>>::value...>::value,
+                          "Component types of the query do not match functor signature!");
+            static_assert(!(is_sparse_component_v<C> || ...),
+                          "Components stored in sparse sets can not be accessed in blocks!");
         }
     };
-    // partial specialization of exec() for other functionals
+
+    template<typename Fn>
+    struct exec_variadic_impl : public exec_variadic_impl<decltype(&Fn::operator())>
+    {
+    };
+
+    // partial specialization of exec() w.r.t. the lambda function as a struct
     template<typename ClassType, typename FirstArgType, typename ReturnType>
     struct exec_variadic_impl<ReturnType (ClassType::*)(FirstArgType&) const>
     {
         template<typename Fn>
         static TaskFuture<ReturnType> impl(Context& c, const Fn& fn)
         {
-            // TODO: acquire read-only lock on the whole context
-            std::promise<ReturnType> pr;
-            FirstArgType             proxy(c);
-            pr.set_value(fn(proxy));
-            return pr.get_future();
+            return c.execWith<ReturnType, FirstArgType>(fn);
         }
     };
 };
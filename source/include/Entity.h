@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <memory_resource>
 #include <set>
 #include <sstream>
 #include <string>
@@ -12,26 +13,33 @@ namespace tx
 {
 
 class ComponentBase;
+struct ComponentDeleter;
 template<typename WrappedClass>
 class Component;
 template<class... C>
 class Aspect;
 
+/**
+ *  A standalone entity that is not stored in a context, e.g. to be built on another thread and
+ *  handed over with Context::ModifyingProxy::setEntity().
+ */
 class Entity
 {
     friend class Context;
 
 public:
-    // default constructor
-    Entity() : components_(){};
+    /// creates an entity whose components are allocated from the given memory resource
+    explicit Entity(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : components_(), resource_(resource){};
 
     // move constructor
-    Entity(Entity&& rhs) : components_(std::move(rhs.components_)) {}
+    Entity(Entity&& rhs) : components_(std::move(rhs.components_)), resource_(rhs.resource_) {}
 
     // move assignment
     Entity& operator=(Entity&& rhs)
     {
         components_ = std::move(rhs.components_);
+        resource_   = rhs.resource_;
         return *this;
     }
 
@@ -48,7 +56,8 @@ public:
     std::string toString() const;
 
 private:
-    std::unordered_map<ComponentID, std::unique_ptr<ComponentBase>> components_;
+    std::unordered_map<ComponentID, std::unique_ptr<ComponentBase, ComponentDeleter>> components_;
+    std::pmr::memory_resource* resource_; ///< allocates the components, they free themselves
 
 public:
     using component_iterator = decltype(components_)::iterator;
@@ -72,15 +81,16 @@ bool Entity::hasComponent(const ComponentID& id) const noexcept
 template<typename C>
 void Entity::setComponent(const ComponentID& id, C&& componentData) noexcept
 {
-    components_.emplace(std::make_pair(id, std::make_unique<Component<C>>(componentData)));
+    using C_t = std::decay_t<C>;
+    components_.emplace(id, allocateComponent<C_t>(resource_, std::forward<C>(componentData)));
 }
 
-std::string Entity::toString() const
+inline std::string Entity::toString() const
 {
     std::stringstream sstr;
     sstr << "Entity [";
     for (const auto& cmp : components_)
-        sstr << cmp.first.name() << ": " << typeid(*cmp.second.get()).name() << "|";
+        sstr << cmp.first.name() << ": " << componentTypeInfo(cmp.second->typeId()).name << "|";
     sstr << " ]";
     return sstr.str();
 }
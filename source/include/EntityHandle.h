@@ -0,0 +1,285 @@
+#pragma once
+
+/**
+ *	\file EntityHandle.h
+ *	Compact handles for entities stored in the context, and the table resolving them.
+ */
+
+#include <stdint.h>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "Identifier.h"
+#include "Snapshot.h"
+
+namespace tx
+{
+
+class Archetype;
+
+/**
+ *  Generational index of an entity: the index of its slot in the context's entity table and the
+ *  generation of that slot. Destroying an entity bumps the generation of its slot, so stale
+ *  handles to destroyed entities can be detected even when the slot is reused.
+ *
+ *  Handles are what the context uses internally and in events, resolving them is a plain array
+ *  access. The default constructed handle is null and never refers to an entity.
+ */
+class EntityHandle
+{
+public:
+    constexpr EntityHandle() = default;
+    constexpr EntityHandle(uint32_t index, uint32_t generation)
+        : index_(index), generation_(generation)
+    {
+    }
+
+    constexpr uint32_t index() const noexcept { return index_; }
+    constexpr uint32_t generation() const noexcept { return generation_; }
+
+    /// whether this is the null handle. A non-null handle may still refer to a destroyed entity.
+    constexpr bool isNull() const noexcept { return generation_ == 0; }
+
+    /// index and generation packed into a single integer, e.g. for hashing or serialization
+    constexpr uint64_t value() const noexcept { return uint64_t(generation_) << 32 | index_; }
+
+    constexpr bool operator==(const EntityHandle& other) const
+    {
+        return index_ == other.index_ && generation_ == other.generation_;
+    }
+
+    constexpr bool operator!=(const EntityHandle& other) const { return !(*this == other); }
+
+    constexpr bool operator<(const EntityHandle& other) const { return value() < other.value(); }
+
+private:
+    uint32_t index_      = 0;
+    uint32_t generation_ = 0; ///< 0 is reserved for the null handle
+};
+
+/// position of an entity inside the archetype storage
+struct EntityLocation
+{
+    Archetype* archetype = nullptr; ///< nullptr while the entity is being created
+    size_t     row       = 0;
+};
+
+/**
+ *  Maps entity handles to their location in the archetype storage.
+ *
+ *  Slots of destroyed entities are reused. Entities can optionally be given a human readable
+ *  EntityID, the table keeps a side table to look up handles by name. Only the name based
+ *  API of the context has to hash EntityIDs, everything else works on handles.
+ *
+ *  Not threadsafe, the context guards access.
+ */
+class EntityTable
+{
+public:
+    /**
+     *  Creates a new entity, optionally with a name, and returns its handle. The entity has no
+     *  location until the caller sets one.
+     *  The name must not be in use already.
+     */
+    EntityHandle create(const EntityID& name = EntityID())
+    {
+        uint32_t index;
+        if (!freeList_.empty()) {
+            index = freeList_.back();
+            freeList_.pop_back();
+        }
+        else
+        {
+            index = static_cast<uint32_t>(slots_.size());
+            slots_.emplace_back();
+        }
+
+        Slot& slot    = slots_[index];
+        slot.location = EntityLocation();
+        slot.alive    = true;
+        EntityHandle handle(index, slot.generation);
+        // keys of the name table are stable, so the slot can point to its name there
+        if (!(name == EntityID())) slot.name = &names_.emplace(name, handle).first->first;
+        ++size_;
+        return handle;
+    }
+
+    /// makes room for n more entities, so that creating them does not reallocate the table
+    void reserve(size_t n)
+    {
+        if (n > freeList_.size()) slots_.reserve(slots_.size() + n - freeList_.size());
+    }
+
+    /**
+     *  Destroys an entity. Its handle and all copies of it become invalid.
+     */
+    void destroy(EntityHandle handle)
+    {
+        if (!isAlive(handle)) return;
+
+        Slot& slot = slots_[handle.index()];
+        if (slot.name != nullptr) names_.erase(*slot.name);
+        slot.name  = nullptr;
+        slot.alive = false;
+        // skip the null generation when wrapping around
+        if (++slot.generation == 0) slot.generation = 1;
+        freeList_.push_back(handle.index());
+        --size_;
+    }
+
+    /// whether the handle refers to an existing entity
+    bool isAlive(EntityHandle handle) const noexcept
+    {
+        return handle.index() < slots_.size() && slots_[handle.index()].alive &&
+               slots_[handle.index()].generation == handle.generation();
+    }
+
+    /// returns the location of the entity, or nullptr if the handle is not alive
+    EntityLocation* find(EntityHandle handle) noexcept
+    {
+        return isAlive(handle) ? &slots_[handle.index()].location : nullptr;
+    }
+
+    const EntityLocation* find(EntityHandle handle) const noexcept
+    {
+        return isAlive(handle) ? &slots_[handle.index()].location : nullptr;
+    }
+
+    /// returns the location of an entity without checking the handle
+    EntityLocation& location(EntityHandle handle) noexcept
+    {
+        return slots_[handle.index()].location;
+    }
+
+    /// looks up an entity by name, returns the null handle if there is none
+    EntityHandle find(const EntityID& name) const
+    {
+        auto it = names_.find(name);
+        return it == names_.end() ? EntityHandle() : it->second;
+    }
+
+    /// the existing entities that have no location yet
+    std::vector<EntityHandle> unlocated() const
+    {
+        std::vector<EntityHandle> handles;
+        for (size_t i = 0; i < slots_.size(); ++i)
+        {
+            if (slots_[i].alive && slots_[i].location.archetype == nullptr)
+                handles.emplace_back(static_cast<uint32_t>(i), slots_[i].generation);
+        }
+        return handles;
+    }
+
+    /// returns the name of an entity, or an empty EntityID if it has none. Unchecked.
+    const EntityID& name(EntityHandle handle) const noexcept
+    {
+        static const EntityID unnamed;
+        const EntityID*       n = slots_[handle.index()].name;
+        return n != nullptr ? *n : unnamed;
+    }
+
+    /// number of existing entities
+    size_t size() const noexcept { return size_; }
+
+    /**
+     *  Writes the slots, free list and names to a snapshot. Locations are not written, the
+     *  context restores them when it reads the components.
+     */
+    void write(std::ostream& out) const
+    {
+        // the generations and the alive flags of all slots, as one array each
+        std::vector<uint32_t> generations(slots_.size());
+        std::vector<uint8_t>  alive(slots_.size());
+        for (size_t i = 0; i < slots_.size(); ++i)
+        {
+            generations[i] = slots_[i].generation;
+            alive[i]       = slots_[i].alive;
+        }
+        detail::writeRaw(out, static_cast<uint32_t>(slots_.size()));
+        detail::writeRaw(out, generations.data(), generations.size());
+        detail::writeRaw(out, alive.data(), alive.size());
+        detail::writeRaw(out, static_cast<uint32_t>(freeList_.size()));
+        detail::writeRaw(out, freeList_.data(), freeList_.size());
+        detail::writeRaw(out, static_cast<uint32_t>(names_.size()));
+        for (const auto& entry : names_)
+        {
+            detail::writeRaw(out, entry.second.index());
+            detail::writeRaw(out, entry.first);
+        }
+    }
+
+    /**
+     *  Replaces the contents of an empty table with the ones written by write(), so that the
+     *  same handles refer to the same entities and the same handles are handed out next.
+     *  All entities are left without location.
+     */
+    void read(std::istream& in)
+    {
+        const size_t          nSlots = detail::readRaw<uint32_t>(in);
+        std::vector<uint32_t> generations(nSlots);
+        std::vector<uint8_t>  alive(nSlots);
+        detail::readRaw(in, generations.data(), nSlots);
+        detail::readRaw(in, alive.data(), nSlots);
+        std::vector<Slot> slots(nSlots);
+        size_t            size = 0;
+        for (size_t i = 0; i < nSlots; ++i)
+        {
+            slots[i].generation = generations[i];
+            slots[i].alive      = alive[i] != 0;
+            size += slots[i].alive;
+        }
+        std::vector<uint32_t> freeList(detail::readRaw<uint32_t>(in));
+        detail::readRaw(in, freeList.data(), freeList.size());
+        std::unordered_map<EntityID, EntityHandle> names;
+        for (uint32_t n = detail::readRaw<uint32_t>(in); n > 0; --n)
+        {
+            const uint32_t index = detail::readRaw<uint32_t>(in);
+            const EntityID name  = detail::readRaw<EntityID>(in);
+            if (index >= slots.size()) throw std::runtime_error("Snapshot is corrupt!");
+            names.emplace(name, EntityHandle(index, slots[index].generation));
+        }
+
+        slots_    = std::move(slots);
+        freeList_ = std::move(freeList);
+        names_    = std::move(names);
+        size_     = size;
+        for (const auto& entry : names_)
+            slots_[entry.second.index()].name = &entry.first;
+    }
+
+private:
+    struct Slot
+    {
+        EntityLocation  location;
+        uint32_t        generation = 1;
+        bool            alive      = false;
+        const EntityID* name       = nullptr; ///< key in names_, if the entity has a name
+    };
+
+    std::vector<Slot>                          slots_;
+    std::vector<uint32_t>                      freeList_;
+    std::unordered_map<EntityID, EntityHandle> names_; ///< side table for named entities
+    size_t                                     size_ = 0;
+};
+
+} // namespace tx
+
+namespace std
+{
+template<>
+struct hash<tx::EntityHandle>
+{
+    size_t operator()(const tx::EntityHandle& handle) const
+    {
+        return std::hash<uint64_t>()(handle.value());
+    }
+};
+}
+inline std::ostream& operator<<(std::ostream& str, const tx::EntityHandle& handle)
+{
+    str << "#" << handle.index() << "." << handle.generation();
+    return str;
+}
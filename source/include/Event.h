@@ -1,11 +1,14 @@
 #pragma once
 
+#include "EntityHandle.h"
+#include "Identifier.h"
+
 namespace tx
 {
 
 /**
  *  Event class signaling that some TX event has occurred.
- *  Stores the ID of the related entity, as well as either the related second entity or the
+ *  Stores the handle of the related entity, as well as either the related second entity or the
  * component.
  */
 struct Event
@@ -16,15 +19,15 @@ struct Event
         COMPONENTADDED,
         COMPONENTCHANGED,
         COMPONENTREMOVED,
-        ENTITYCREATED,
-        ENTITYREMOVED
+        ENTITYCREATED, ///< per component of entities from createEntities() or readSnapshot()
+        ENTITYREMOVED  ///< per component of an entity removed by ModifyingProxy::removeEntities()
     };
 
-    Event(EventType type_, const EntityID& eId0_, const EntityID& eId1_)
-        : type(type_), eId(eId0_), eId1(eId1_){};
-    Event(EventType type_, const EntityID& eId_, const ComponentID& cId_)
-        : type(type_), eId(eId_), cId(cId_){};
-    Event(EventType type_, const SystemID& sId_) : type(type_), sId(sId_), eId1(0, 0, 0, 0){};
+    Event(EventType type_, EntityHandle entity_, EntityHandle entity1_)
+        : type(type_), entity(entity_), entity1(entity1_){};
+    Event(EventType type_, EntityHandle entity_, const ComponentID& cId_)
+        : type(type_), entity(entity_), cId(cId_){};
+    Event(EventType type_, const SystemID& sId_) : type(type_), sId(sId_), entity1(){};
 
     Event(Event&& rhs) = default;
     Event& operator=(Event&& rhs) = default;
@@ -33,12 +36,12 @@ struct Event
 
     EventType type;
     union {
-        SystemID sId;
-        EntityID eId;
+        SystemID     sId;
+        EntityHandle entity;
     };
     union {
-        ComponentID cId;
-        EntityID    eId1;
+        ComponentID  cId;
+        EntityHandle entity1;
     };
 };
 
@@ -1,11 +1,13 @@
 #pragma once
 
 #include <stdint.h>
+#include <algorithm>
 #include <array>
 #include <cstring>
 #include <functional>
 #include <numeric>
 #include <string>
+#include <string_view>
 #include <typeinfo>
 
 #include <cassert>
@@ -75,6 +77,29 @@ bool constexpr array_less(const std::array<T, N>& a, const std::array<T, N>& b)
 {
     return array_less(a, b, 0);
 }
+
+/// human readable name of a type, derived at compile time without RTTI. For debugging only.
+template<typename T>
+const char* typeName() noexcept
+{
+#if defined(_MSC_VER)
+    static constexpr std::string_view signature = __FUNCSIG__;
+    static constexpr std::string_view prefix    = "typeName<";
+    static constexpr std::string_view suffix    = ">(void) noexcept";
+#else
+    static constexpr std::string_view signature = __PRETTY_FUNCTION__;
+    static constexpr std::string_view prefix    = "T = ";
+    static constexpr std::string_view suffix    = "]";
+#endif
+    static const std::string name = [] {
+        const size_t begin = signature.find(prefix);
+        if (begin == std::string_view::npos) return std::string(signature);
+        std::string_view n = signature.substr(begin + prefix.size());
+        // GCC appends the aliases used in the signature after a ';'
+        return std::string(n.substr(0, std::min(n.find(';'), n.rfind(suffix))));
+    }();
+    return name.c_str();
+}
 }
 
 template<typename T>
@@ -97,6 +122,12 @@ public:
     {
     }
 
+    /// initializes from a name that is only known at runtime, truncated to MAX_LENGTH - 1 chars
+    explicit Identifier_(std::string_view name) : id_{{0, 0, 0, 0}}
+    {
+        name.copy(name__, MAX_LENGTH - 1);
+    }
+
     // Convenience function to initialize from a class type info
     Identifier_(const std::type_info& ti)
     {
@@ -104,7 +135,14 @@ public:
         name__[MAX_LENGTH - 1] = '\0';
     }
 
-    constexpr uint64_t hash() const { return detail::accum_hash(&id_[0], &id_[NUM_WORDS - 1], 0); }
+    /// the same as accum_hash() over the four words, unrolled so that it is folded into few
+    /// instructions, or into a constant for literals
+    constexpr uint64_t hash() const
+    {
+        using detail::hash_combine;
+        return hash_combine(id_[0],
+                            hash_combine(id_[1], hash_combine(id_[2], hash_combine(0, id_[3]))));
+    }
 
     std::string name() const
     {
@@ -166,7 +204,7 @@ class hash<tx::Identifier> : public tx::IdentifierHash<tx::Identifier>
 {
 };
 }
-std::ostream& operator<<(std::ostream& str, const tx::Identifier& iId)
+inline std::ostream& operator<<(std::ostream& str, const tx::Identifier& iId)
 {
     str << iId.name();
     return str;
@@ -179,7 +217,7 @@ class hash<tx::ComponentID> : public tx::IdentifierHash<tx::ComponentID>
 {
 };
 }
-std::ostream& operator<<(std::ostream& str, const tx::ComponentID& cId)
+inline std::ostream& operator<<(std::ostream& str, const tx::ComponentID& cId)
 {
     str << cId.name();
     return str;
@@ -192,7 +230,7 @@ class hash<tx::EntityID> : public tx::IdentifierHash<tx::EntityID>
 {
 };
 }
-std::ostream& operator<<(std::ostream& str, const tx::EntityID& eId)
+inline std::ostream& operator<<(std::ostream& str, const tx::EntityID& eId)
 {
     str << eId.name();
     return str;
@@ -205,7 +243,7 @@ class hash<tx::SystemID> : public tx::IdentifierHash<tx::SystemID>
 {
 };
 }
-std::ostream& operator<<(std::ostream& str, const tx::SystemID& sId)
+inline std::ostream& operator<<(std::ostream& str, const tx::SystemID& sId)
 {
     str << sId.name();
     return str;
@@ -218,7 +256,7 @@ class hash<tx::TagID> : public tx::IdentifierHash<tx::TagID>
 {
 };
 }
-std::ostream& operator<<(std::ostream& str, const tx::TagID& tId)
+inline std::ostream& operator<<(std::ostream& str, const tx::TagID& tId)
 {
     str << tId.name();
     return str;
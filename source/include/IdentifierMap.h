@@ -0,0 +1,204 @@
+#pragma once
+
+/**
+ *	\file IdentifierMap.h
+ *	Dense integer indices for identifiers, and maps keyed by them. Every identifier is interned
+ *	once into a process-wide table, the maps of the context are vectors indexed by it instead of
+ *	hash maps of their own.
+ */
+
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "Identifier.h"
+
+namespace tx
+{
+
+/**
+ *  Dense integer identifying an identifier of one type, assigned on first use by
+ *  identifierIndex(). Only stable within a run.
+ */
+using IdentifierIndex = uint32_t;
+
+namespace detail
+{
+/**
+ *  The process-wide table of the interned identifiers of type ID. An open addressing hash table
+ *  that is only replaced, never changed in place, when it grows, so lookups do not lock. Tables
+ *  that were replaced are kept, a lookup might still be probing them.
+ */
+template<typename ID>
+class IdentifierTable
+{
+public:
+    static IdentifierTable& instance()
+    {
+        static IdentifierTable table;
+        return table;
+    }
+
+    /// \return false if the identifier was not interned yet
+    bool find(const ID& id, IdentifierIndex& index) const noexcept
+    {
+        const Table& table = *current_.load(std::memory_order_acquire);
+        for (size_t i = id.hash() & table.mask;; i = (i + 1) & table.mask)
+        {
+            const uint32_t entry = table.slots[i].entry.load(std::memory_order_acquire);
+            if (entry == 0) return false;
+            if (table.slots[i].words == id.id_) {
+                index = entry - 1;
+                return true;
+            }
+        }
+    }
+
+    IdentifierIndex intern(const ID& id)
+    {
+        IdentifierIndex index;
+        if (find(id, index)) return index;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (find(id, index)) return index;
+        Table* table = current_.load(std::memory_order_relaxed);
+        // at most half full, so that probing ends soon at an empty slot
+        if (2 * (size_ + 1) > table->mask + 1) {
+            auto grown = std::make_unique<Table>(2 * (table->mask + 1));
+            for (size_t i = 0; i <= table->mask; ++i)
+            {
+                const uint32_t entry = table->slots[i].entry.load(std::memory_order_relaxed);
+                if (entry != 0) grown->insert(table->slots[i].words, entry);
+            }
+            table = grown.get();
+            tables_.push_back(std::move(grown));
+            current_.store(table, std::memory_order_release);
+        }
+        index = static_cast<IdentifierIndex>(size_++);
+        table->insert(id.id_, index + 1);
+        return index;
+    }
+
+private:
+    using Words = std::array<uint64_t, ID::NUM_WORDS>;
+
+    struct Slot
+    {
+        Words                 words{};
+        std::atomic<uint32_t> entry{0}; ///< index + 1 of the identifier, 0 while the slot is empty
+    };
+
+    struct Table
+    {
+        explicit Table(size_t capacity) : mask(capacity - 1), slots(new Slot[capacity]) {}
+
+        /// the words are written before the entry publishes them
+        void insert(const Words& words, uint32_t entry) noexcept
+        {
+            size_t i = ID(words[0], words[1], words[2], words[3]).hash() & mask;
+            while (slots[i].entry.load(std::memory_order_relaxed) != 0)
+                i = (i + 1) & mask;
+            slots[i].words = words;
+            slots[i].entry.store(entry, std::memory_order_release);
+        }
+
+        size_t                  mask;
+        std::unique_ptr<Slot[]> slots;
+    };
+
+    IdentifierTable()
+    {
+        tables_.push_back(std::make_unique<Table>(64));
+        current_.store(tables_.back().get(), std::memory_order_release);
+    }
+
+    std::mutex                          mutex_; ///< serializes intern()
+    size_t                              size_ = 0;
+    std::vector<std::unique_ptr<Table>> tables_;
+    std::atomic<Table*>                 current_{nullptr};
+};
+} // namespace detail
+
+/**
+ *  The dense index of an identifier, interned on first use. Lookups of identifiers that were
+ *  interned before do not lock.
+ */
+template<typename T>
+IdentifierIndex identifierIndex(const Identifier_<T>& id)
+{
+    return detail::IdentifierTable<Identifier_<T>>::instance().intern(id);
+}
+
+/**
+ *  Looks up the dense index of an identifier without interning it.
+ *  \return false if the identifier was never interned, so nothing can be keyed by it
+ */
+template<typename T>
+bool findIdentifierIndex(const Identifier_<T>& id, IdentifierIndex& index) noexcept
+{
+    return detail::IdentifierTable<Identifier_<T>>::instance().find(id, index);
+}
+
+/**
+ *  A map from identifiers to values, looked up by the dense index of the identifier. Supports
+ *  the part of the std::unordered_map interface the context uses; iterating visits the entries
+ *  in the order they were inserted. Entries can not be erased.
+ *
+ *  find() and count() do not intern the identifier they are given, so looking up identifiers
+ *  that were never inserted anywhere does not grow the process-wide table. Like a standard
+ *  container, concurrent lookups are safe, but not concurrently with inserting.
+ */
+template<typename ID, typename T>
+class IdentifierMap
+{
+public:
+    using value_type     = std::pair<const ID, T>;
+    using iterator       = typename std::vector<value_type>::iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
+    iterator       begin() noexcept { return entries_.begin(); }
+    iterator       end() noexcept { return entries_.end(); }
+    const_iterator begin() const noexcept { return entries_.begin(); }
+    const_iterator end() const noexcept { return entries_.end(); }
+
+    bool   empty() const noexcept { return entries_.empty(); }
+    size_t size() const noexcept { return entries_.size(); }
+
+    iterator find(const ID& id) noexcept { return begin() + position(id); }
+    const_iterator find(const ID& id) const noexcept { return begin() + position(id); }
+
+    size_t count(const ID& id) const noexcept { return position(id) < entries_.size() ? 1 : 0; }
+
+    /// inserts a value-initialized entry if there is none, which invalidates iterators
+    T& operator[](const ID& id)
+    {
+        const IdentifierIndex index = identifierIndex(id);
+        if (index >= positions_.size()) positions_.resize(index + 1, 0);
+        if (positions_[index] == 0) {
+            entries_.emplace_back(id, T());
+            positions_[index] = static_cast<uint32_t>(entries_.size());
+        }
+        return entries_[positions_[index] - 1].second;
+    }
+
+private:
+    /// \return the position of the entry of id in entries_, or its size if there is none
+    size_t position(const ID& id) const noexcept
+    {
+        IdentifierIndex index;
+        if (!findIdentifierIndex(id, index) || index >= positions_.size() ||
+            positions_[index] == 0)
+            return entries_.size();
+        return positions_[index] - 1;
+    }
+
+    std::vector<uint32_t>   positions_; ///< position + 1 in entries_ by index, 0 if there is none
+    std::vector<value_type> entries_;
+};
+
+} // namespace tx
@@ -0,0 +1,93 @@
+#pragma once
+
+/**
+ *	\file MappedSnapshot.h
+ *	Snapshot files mapped into memory, see Context::mapSnapshot(). Uses mmap() where it is
+ *	available and reads the whole file into memory elsewhere.
+ */
+
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TX_HAS_MMAP 1
+#else
+#define TX_HAS_MMAP 0
+#endif
+
+namespace tx
+{
+namespace detail
+{
+
+/**
+ *  A snapshot file mapped into memory. The mapping is private, writing to it copies the written
+ *  pages and never modifies the file. As a stream buffer it hands out the mapped bytes without
+ *  buffering them, so position() is where the stream reading from it is in the file.
+ */
+class MappedSnapshot : public std::streambuf
+{
+public:
+    /// maps the file, \throw std::runtime_error if it can not be opened or is empty
+    explicit MappedSnapshot(const std::string& path)
+    {
+#if TX_HAS_MMAP
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Can not open snapshot " + path + "!");
+        struct stat info;
+        void*       data = MAP_FAILED;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            size_ = static_cast<size_t>(info.st_size);
+            data  = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        }
+        // the mapping does not need the descriptor
+        ::close(fd);
+        if (data == MAP_FAILED) throw std::runtime_error("Can not map snapshot " + path + "!");
+        data_ = static_cast<char*>(data);
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) throw std::runtime_error("Can not open snapshot " + path + "!");
+        size_ = static_cast<size_t>(file.tellg());
+        buffer_.reset(new char[size_]);
+        file.seekg(0);
+        file.read(buffer_.get(), static_cast<std::streamsize>(size_));
+        if (!file) throw std::runtime_error("Can not read snapshot " + path + "!");
+        data_ = buffer_.get();
+#endif
+        setg(data_, data_, data_ + size_);
+    }
+
+    ~MappedSnapshot() override
+    {
+#if TX_HAS_MMAP
+        ::munmap(data_, size_);
+#endif
+    }
+
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+    /// the next byte that is read from the snapshot
+    char* position() noexcept { return gptr(); }
+
+    /// number of bytes after position()
+    size_t remaining() const noexcept { return static_cast<size_t>(egptr() - gptr()); }
+
+private:
+    char*  data_ = nullptr;
+    size_t size_ = 0;
+#if !TX_HAS_MMAP
+    std::unique_ptr<char[]> buffer_;
+#endif
+};
+
+} // namespace detail
+} // namespace tx
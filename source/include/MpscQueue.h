@@ -0,0 +1,179 @@
+/**
+ * The MpscQueue class.
+ * Unbounded lock-free multi-producer single-consumer queue, after Dmitry Vyukov's intrusive MPSC
+ * node-based queue. Pushing is a single atomic exchange and never blocks, only the consumer
+ * walks and frees the nodes.
+ */
+#pragma once
+
+#ifndef MPSCQUEUE_H__
+#define MPSCQUEUE_H__
+
+#include <atomic>
+#include <new>
+#include <utility>
+
+namespace tx
+{
+template<typename T>
+class MpscQueue
+{
+    struct Node
+    {
+        Node(void) = default;
+
+        template<typename... Args>
+        explicit Node(Args&&... args)
+        {
+            new (&m_storage) T(std::forward<Args>(args)...);
+        }
+
+        T& value(void) noexcept { return *std::launder(reinterpret_cast<T*>(&m_storage)); }
+
+        std::atomic<Node*> m_next{nullptr};
+        alignas(T) unsigned char m_storage[sizeof(T)];
+    };
+
+public:
+    /**
+     * Constructor.
+     */
+    MpscQueue(void) : m_head{&m_stub}, m_tail{&m_stub} {}
+
+    MpscQueue(const MpscQueue& rhs) = delete;
+    MpscQueue& operator=(const MpscQueue& rhs) = delete;
+
+    /**
+     * Destructor. Discards all values that were not consumed.
+     */
+    ~MpscQueue(void)
+    {
+        consume([](T&&) {});
+        if (m_tail != &m_stub) {
+            delete m_tail;
+        }
+    }
+
+    /**
+     * Construct a value at the end of the queue. Can be called by any thread.
+     */
+    template<typename... Args>
+    void push(Args&&... args)
+    {
+        Node* node = new Node(std::forward<Args>(args)...);
+        // publish the node, then link it to its predecessor. Until the link is stored, the
+        // consumer sees the queue ending at the predecessor.
+        Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->m_next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * Copy the values [first, last) to the end of the queue as one contiguous sequence, with a
+     * single atomic operation on the shared end of the queue. Can be called by any thread.
+     * If copying a value throws, none of them are pushed.
+     */
+    template<typename InputIt>
+    void pushRange(InputIt first, InputIt last)
+    {
+        if (first == last) {
+            return;
+        }
+        // the chain is private until it is published, so it can be linked without ordering
+        Node* chainHead = new Node(*first);
+        Node* chainTail = chainHead;
+        try
+        {
+            for (++first; first != last; ++first)
+            {
+                Node* node = new Node(*first);
+                chainTail->m_next.store(node, std::memory_order_relaxed);
+                chainTail = node;
+            }
+        }
+        catch (...)
+        {
+            // nothing was published, free the nodes copied so far
+            while (chainHead != nullptr)
+            {
+                Node* next = chainHead->m_next.load(std::memory_order_relaxed);
+                chainHead->value().~T();
+                delete chainHead;
+                chainHead = next;
+            }
+            throw;
+        }
+        Node* prev = m_head.exchange(chainTail, std::memory_order_acq_rel);
+        prev->m_next.store(chainHead, std::memory_order_release);
+    }
+
+    /**
+     * Take the first value from the queue. May only be called by the consumer thread.
+     * Returns true if a value was successfully written to the out parameter, false otherwise.
+     * Values pushed concurrently might not be visible yet.
+     */
+    bool tryPop(T& out)
+    {
+        Node* next = m_tail->m_next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return false;
+        }
+        out = std::move(next->value());
+        advance(next);
+        return true;
+    }
+
+    /**
+     * Calls fn with every value that was pushed before this call, in order, and removes them from
+     * the queue. Values pushed while consuming are left for the next call, so that a steady
+     * stream of producers can not keep the consumer busy forever. May only be called by the
+     * consumer thread.
+     * Returns the number of consumed values.
+     */
+    template<typename Fn>
+    std::size_t consume(Fn&& fn)
+    {
+        Node* const last  = m_head.load(std::memory_order_acquire);
+        std::size_t count = 0;
+        while (m_tail != last)
+        {
+            Node* next = m_tail->m_next.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                // a producer has not linked its node yet, the rest is consumed next time
+                break;
+            }
+            T value = std::move(next->value());
+            advance(next);
+            fn(std::move(value));
+            ++count;
+        }
+        return count;
+    }
+
+    /**
+     * Check whether or not the queue is empty. Only a snapshot if other threads push values.
+     */
+    bool empty(void) const
+    {
+        return m_tail->m_next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    /**
+     * Makes next, whose value was moved out, the new stub node and frees the old one.
+     */
+    void advance(Node* next) noexcept
+    {
+        next->value().~T();
+        if (m_tail != &m_stub) {
+            delete m_tail;
+        }
+        m_tail = next;
+    }
+
+    alignas(64) std::atomic<Node*> m_head; ///< last pushed node, shared by the producers
+    alignas(64) Node* m_tail;              ///< stub node before the first value, consumer only
+    Node m_stub;
+};
+}
+
+#endif
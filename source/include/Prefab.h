@@ -0,0 +1,70 @@
+#pragma once
+
+/**
+ *	\file Prefab.h
+ *	Prefabs are template entities registered with the context. Their components are kept in the
+ *	layout of the archetype their instances are stored in, so instantiating a prefab copies one
+ *	row per column and does not need to look at the components' IDs or types again.
+ */
+
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include "Archetype.h"
+#include "Component.h"
+#include "Identifier.h"
+
+namespace tx
+{
+
+class Context;
+
+/**
+ *  A template entity. Obtained from Context::ModifyingProxy::createPrefab() and instantiated with
+ *  Context::ModifyingProxy::createEntities() of the same context. Lives as long as the context.
+ */
+class Prefab
+{
+public:
+    Prefab(const Prefab&) = delete;
+    Prefab& operator=(const Prefab&) = delete;
+
+    /// the archetype the instances are stored in
+    const Archetype& archetype() const noexcept { return *archetype_; }
+
+    /// IDs of all components of the prefab, including the ones stored in sparse sets
+    const std::vector<ComponentID>& componentIds() const noexcept { return componentIds_; }
+
+private:
+    friend class Context;
+
+    /// creates the columns of the default values like the ones of the instances' archetype
+    struct ColumnFactory
+    {
+        const Archetype& archetype;
+
+        std::unique_ptr<ComponentColumnBase>
+        operator()(const std::pair<ComponentID, ComponentTypeID>& entry) const
+        {
+            return archetype.column(static_cast<size_t>(archetype.columnIndex(entry.first)))
+                .cloneEmpty();
+        }
+    };
+
+    Prefab(const Context& context, Archetype& archetype, std::pmr::memory_resource* resource)
+        : context_(&context),
+          archetype_(&archetype),
+          defaults_(archetype.signature(), ColumnFactory{archetype}, resource)
+    {
+    }
+
+    const Context* context_; ///< the context that created the prefab and owns archetype_
+    Archetype*     archetype_;
+    Archetype  defaults_; ///< a single row with the default values, same columns as archetype_
+    std::vector<std::pair<ComponentID, ComponentPtr>> sparseDefaults_; ///< stored in sparse sets
+    std::vector<ComponentID>                          componentIds_;
+};
+
+} // namespace tx
@@ -0,0 +1,78 @@
+#pragma once
+
+/**
+ *	\file Query.h
+ *	Persistent queries for each(). A query is registered with the context once and from then on
+ *	keeps the list of archetypes that contain all of its components up to date, so iterating it
+ *	does not need to look at any archetype or entity that does not match.
+ */
+
+#include <array>
+#include <vector>
+
+#include "Archetype.h"
+#include "Aspect.h"
+#include "Identifier.h"
+#include "utils.h"
+
+namespace tx
+{
+
+/**
+ *  Type-erased base class of all queries, lets the context announce new archetypes.
+ */
+class QueryBase
+{
+public:
+    virtual ~QueryBase(){};
+
+    /// the archetypes containing all components of the query, including currently empty ones
+    const std::vector<Archetype*>& archetypes() const noexcept { return archetypes_; }
+
+    /// number of entities in the matching archetypes, i.e. without components in sparse sets
+    size_t size() const noexcept
+    {
+        size_t n = 0;
+        for (const Archetype* a : archetypes_)
+            n += a->size();
+        return n;
+    }
+
+protected:
+    friend class Context;
+
+    /// adds an archetype to the matching ones if it contains all components of the query
+    virtual void addIfMatching(Archetype& archetype) = 0;
+
+    std::vector<Archetype*> archetypes_;
+};
+
+/**
+ *  Query for all entities that have components of the (plain, unqualified) types C with the
+ *  given IDs. Obtained from Context::query() and iterated with Context::each().
+ */
+template<typename... C>
+class Query : public QueryBase
+{
+public:
+    static constexpr size_t nCmp = sizeof...(C);
+    using IDs_type               = std::array<ComponentID, nCmp>;
+
+    static_assert(all_true<std::is_same<C, component_value_t<C>>::value...>::value,
+                  "Queries are declared with plain component types, without const or references!");
+
+    explicit Query(const IDs_type& ids) : aspect_(ids) {}
+
+    const IDs_type& ids() const noexcept { return aspect_.ids_; }
+
+protected:
+    void addIfMatching(Archetype& archetype) override
+    {
+        if (aspect_.checkAspect(archetype)) archetypes_.push_back(&archetype);
+    }
+
+private:
+    Aspect<C...> aspect_;
+};
+
+} // namespace tx
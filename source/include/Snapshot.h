@@ -0,0 +1,162 @@
+#pragma once
+
+/**
+ *	\file Snapshot.h
+ *	Encoding of components in binary snapshots, see Context::writeSnapshot(). Components are
+ *	written column by column: trivially copyable types as one contiguous blob of their bytes,
+ *	other types through a component_serializer. Snapshots use the native byte order and type
+ *	layout, they are meant to be read by the same build on the same platform.
+ */
+
+#include <stdint.h>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "Identifier.h"
+
+namespace tx
+{
+
+/**
+ *  Hook to write components of type C to snapshots, e.g. because they own memory:
+ *
+ *      template<>
+ *      struct tx::component_serializer<Mesh>
+ *      {
+ *          static void write(std::ostream& out, const Mesh& mesh);
+ *          static void read(std::istream& in, Mesh& mesh);
+ *      };
+ *
+ *  read() is passed a default constructed component. A serializer takes precedence over
+ *  copying the bytes of trivially copyable types. Components of types that have neither are
+ *  left out of snapshots.
+ */
+template<typename C>
+struct component_serializer
+{
+};
+
+/// how the components of a type are encoded in snapshots
+enum class SnapshotEncoding : uint8_t
+{
+    None,  ///< left out of snapshots
+    Bytes, ///< the bytes of all components of a column at once
+    Custom ///< one component after the other, by component_serializer
+};
+
+/**
+ *  Components of a snapshot that were not restored by Context::readSnapshot(), because their
+ *  type is not registered in the reading process, has another size or encoding, or their sparse
+ *  pool is in use already. Columns of the same ID and type are reported once.
+ */
+struct SkippedSnapshotColumn
+{
+    ComponentID cId;
+    std::string typeName; ///< the name the type was written with, see componentTypeInfo()
+    uint64_t    count = 0; ///< the number of components that were skipped
+};
+
+namespace detail
+{
+template<typename C, typename = void>
+struct has_component_serializer : std::false_type
+{
+};
+
+template<typename C>
+struct has_component_serializer<
+    C, std::void_t<decltype(component_serializer<C>::write(std::declval<std::ostream&>(),
+                                                           std::declval<const C&>())),
+                   decltype(component_serializer<C>::read(std::declval<std::istream&>(),
+                                                          std::declval<C&>()))>>
+    : std::true_type
+{
+};
+} // namespace detail
+
+/// the encoding of components of type C in snapshots, read into default constructed components
+template<typename C>
+constexpr SnapshotEncoding snapshot_encoding_v =
+    !std::is_default_constructible<C>::value       ? SnapshotEncoding::None
+    : detail::has_component_serializer<C>::value   ? SnapshotEncoding::Custom
+    : std::is_trivially_copyable<C>::value         ? SnapshotEncoding::Bytes
+                                                   : SnapshotEncoding::None;
+
+namespace detail
+{
+template<typename T>
+void writeRaw(std::ostream& out, const T& value)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "only plain values can be written raw");
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+T readRaw(std::istream& in)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "only plain values can be read raw");
+    T value;
+    in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    if (!in) throw std::runtime_error("Snapshot ended unexpectedly!");
+    return value;
+}
+
+/// writes n plain values at once
+template<typename T>
+void writeRaw(std::ostream& out, const T* values, size_t n)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "only plain values can be written raw");
+    out.write(reinterpret_cast<const char*>(values), static_cast<std::streamsize>(n * sizeof(T)));
+}
+
+/// reads n plain values at once
+template<typename T>
+void readRaw(std::istream& in, T* values, size_t n)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "only plain values can be read raw");
+    in.read(reinterpret_cast<char*>(values), static_cast<std::streamsize>(n * sizeof(T)));
+    if (!in) throw std::runtime_error("Snapshot ended unexpectedly!");
+}
+
+/// writes n components encoded as snapshot_encoding_v<C>
+template<typename C>
+void writeComponents(std::ostream& out, const C* values, size_t n)
+{
+    if constexpr (snapshot_encoding_v<C> == SnapshotEncoding::Custom) {
+        for (size_t i = 0; i < n; ++i)
+            component_serializer<C>::write(out, values[i]);
+    }
+    else if constexpr (snapshot_encoding_v<C> == SnapshotEncoding::Bytes)
+    {
+        writeRaw(out, values, n);
+    }
+}
+
+/// appends n components written by writeComponents() to a vector
+template<typename C, typename Vector>
+void readComponents(std::istream& in, Vector& values, size_t n)
+{
+    if constexpr (snapshot_encoding_v<C> == SnapshotEncoding::Custom) {
+        values.reserve(values.size() + n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            C value;
+            component_serializer<C>::read(in, value);
+            values.push_back(std::move(value));
+        }
+    }
+    else if constexpr (snapshot_encoding_v<C> == SnapshotEncoding::Bytes)
+    {
+        const size_t first = values.size();
+        values.resize(first + n);
+        readRaw(in, values.data() + first, n);
+    }
+    if (!in) throw std::runtime_error("Snapshot ended unexpectedly!");
+}
+} // namespace detail
+
+} // namespace tx
@@ -0,0 +1,245 @@
+#pragma once
+
+/**
+ *	\file SparsePool.h
+ *	Sparse set storage for components that are added and removed frequently, e.g. tags or
+ *	transient flags. Adding or removing such a component does not move the entity between
+ *	archetypes, it only touches the pool of that component.
+ */
+
+#include <stdint.h>
+#include <memory>
+#include <memory_resource>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Component.h"
+#include "EntityHandle.h"
+
+namespace tx
+{
+
+/**
+ *  Type-erased base class of a sparse set storing the components of one ComponentID.
+ *
+ *  The components are stored densely, in no particular order, next to the handles of their
+ *  entities. The sparse array maps the index of an entity handle to the dense position, so
+ *  finding, adding and removing a component is O(1) and iterating all of them is a linear scan.
+ */
+class SparsePoolBase
+{
+public:
+    SparsePoolBase(ComponentTypeID typeId, std::pmr::memory_resource* resource)
+        : typeId_(typeId), sparse_(resource), entities_(resource), ticks_(resource)
+    {
+    }
+    virtual ~SparsePoolBase(){};
+
+    SparsePoolBase(const SparsePoolBase&) = delete;
+    SparsePoolBase& operator=(const SparsePoolBase&) = delete;
+
+    /// identifies the type of the stored components
+    ComponentTypeID typeId() const noexcept { return typeId_; }
+
+    /// number of stored components
+    size_t size() const noexcept { return entities_.size(); }
+
+    /// handles of the entities owning the stored components, in dense order
+    const std::pmr::vector<EntityHandle>& entities() const noexcept { return entities_; }
+
+    /// the memory resource the components are allocated from
+    std::pmr::memory_resource* resource() const noexcept
+    {
+        return entities_.get_allocator().resource();
+    }
+
+    /// the change tick of every stored component, in dense order, see Context::changeTick()
+    ChangeTick* ticks() noexcept { return ticks_.data(); }
+
+    const ChangeTick* ticks() const noexcept { return ticks_.data(); }
+
+    bool contains(EntityHandle entity) const noexcept { return indexOf(entity) != npos; }
+
+    /**
+     *  Removes the component of an entity by moving the last component into its place.
+     *  \return whether the entity had a component in this pool
+     */
+    bool remove(EntityHandle entity)
+    {
+        const uint32_t idx = indexOf(entity);
+        if (idx == npos) return false;
+
+        swapRemoveValue(idx);
+        const EntityHandle last = entities_.back();
+        entities_[idx]          = last;
+        ticks_[idx]             = ticks_.back();
+        sparse_[last.index()]   = idx;
+        sparse_[entity.index()] = npos;
+        entities_.pop_back();
+        ticks_.pop_back();
+        return true;
+    }
+
+    /// adds or replaces the component of an entity with the value wrapped in component
+    virtual void moveFrom(EntityHandle entity, ComponentBase& component, ChangeTick tick) = 0;
+
+    /// adds copies of the value wrapped in prototype, which has to be copyable, to n entities
+    /// that do not have a component in this pool yet
+    virtual void appendCopies(const EntityHandle* entities, size_t n,
+                              const ComponentBase& prototype, ChangeTick tick) = 0;
+
+    /// writes the stored components, in dense order, encoded as the type's SnapshotEncoding
+    virtual void writeValues(std::ostream& out) const = 0;
+
+    /// adds n components written by writeValues() to entities that do not have one in this pool
+    virtual void readValues(std::istream& in, const EntityHandle* entities, size_t n,
+                            ChangeTick tick) = 0;
+
+protected:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    /// dense position of the component of an entity, or npos
+    uint32_t indexOf(EntityHandle entity) const noexcept
+    {
+        if (entity.index() >= sparse_.size()) return npos;
+        const uint32_t idx = sparse_[entity.index()];
+        return idx != npos && entities_[idx] == entity ? idx : npos;
+    }
+
+    /// appends an entity to the dense array, its value has to be appended by the caller
+    uint32_t append(EntityHandle entity, ChangeTick tick)
+    {
+        if (entity.index() >= sparse_.size()) sparse_.resize(entity.index() + 1, npos);
+        const uint32_t idx      = static_cast<uint32_t>(entities_.size());
+        sparse_[entity.index()] = idx;
+        entities_.push_back(entity);
+        ticks_.push_back(tick);
+        return idx;
+    }
+
+    /// reserves the dense arrays for n more components, the values are reserved by the caller
+    void reserveDense(size_t n)
+    {
+        entities_.reserve(entities_.size() + n);
+        ticks_.reserve(ticks_.size() + n);
+    }
+
+    /// removes the value at idx by moving the last value into its place
+    virtual void swapRemoveValue(size_t idx) = 0;
+
+private:
+    ComponentTypeID           typeId_;
+    std::pmr::vector<uint32_t>     sparse_;   ///< dense position by entity index, npos if none
+    std::pmr::vector<EntityHandle> entities_; ///< owner of every dense value
+    std::pmr::vector<ChangeTick>   ticks_;    ///< change tick of every dense value
+};
+
+/**
+ *  Sparse set of components of type C.
+ */
+template<typename C>
+class SparsePool : public SparsePoolBase
+{
+public:
+    explicit SparsePool(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : SparsePoolBase(componentTypeId<C>(), resource), values_(resource)
+    {
+    }
+
+    /// the component of an entity, or nullptr if it has none
+    C* find(EntityHandle entity) noexcept
+    {
+        const uint32_t idx = indexOf(entity);
+        return idx == npos ? nullptr : &values_[idx];
+    }
+
+    const C* find(EntityHandle entity) const noexcept
+    {
+        const uint32_t idx = indexOf(entity);
+        return idx == npos ? nullptr : &values_[idx];
+    }
+
+    /// the component of an entity and its change tick, or nullptrs if it has none
+    std::pair<C*, ChangeTick*> findWithTick(EntityHandle entity) noexcept
+    {
+        const uint32_t idx = indexOf(entity);
+        if (idx == npos) return {nullptr, nullptr};
+        return {&values_[idx], ticks() + idx};
+    }
+
+    /// creates or replaces the component of an entity, written at the given tick
+    template<typename... Args>
+    C& emplace(EntityHandle entity, ChangeTick tick, Args&&... args)
+    {
+        const uint32_t idx = indexOf(entity);
+        if (idx != npos) {
+            ticks()[idx] = tick;
+            return values_[idx] = C(std::forward<Args>(args)...);
+        }
+
+        append(entity, tick);
+        values_.emplace_back(std::forward<Args>(args)...);
+        return values_.back();
+    }
+
+    void moveFrom(EntityHandle entity, ComponentBase& component, ChangeTick tick) override
+    {
+        emplace(entity, tick, std::move(*static_cast<Component<C>&>(component)));
+    }
+
+    void appendCopies(const EntityHandle* entities, size_t n, const ComponentBase& prototype,
+                      ChangeTick tick) override
+    {
+        if constexpr (std::is_copy_constructible<C>::value) {
+            const C& value = *static_cast<const Component<C>&>(prototype);
+            reserveDense(n);
+            values_.reserve(values_.size() + n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                append(entities[i], tick);
+                values_.push_back(value);
+            }
+        }
+    }
+
+    void writeValues(std::ostream& out) const override
+    {
+        detail::writeComponents(out, values_.data(), values_.size());
+    }
+
+    void readValues(std::istream& in, const EntityHandle* entities, size_t n,
+                    ChangeTick tick) override
+    {
+        reserveDense(n);
+        for (size_t i = 0; i < n; ++i)
+            append(entities[i], tick);
+        detail::readComponents<C>(in, values_, n);
+    }
+
+    /// the stored components, in the order of entities()
+    C* data() noexcept { return values_.data(); }
+
+    const C* data() const noexcept { return values_.data(); }
+
+protected:
+    void swapRemoveValue(size_t idx) override
+    {
+        if (idx + 1 != values_.size()) values_[idx] = std::move(values_.back());
+        values_.pop_back();
+    }
+
+private:
+    std::pmr::vector<C> values_;
+};
+
+namespace detail
+{
+template<typename C>
+std::unique_ptr<SparsePoolBase> makePool(std::pmr::memory_resource* resource)
+{
+    return std::make_unique<SparsePool<C>>(resource);
+}
+} // namespace detail
+
+} // namespace tx
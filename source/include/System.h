@@ -1,11 +1,17 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
-#include <mutex>
-#include <queue>
+#include <initializer_list>
+#include <functional>
+#include <iterator>
+#include <string_view>
 #include <type_traits>
+#include <vector>
 
+#include "Component.h"
 #include "Event.h"
+#include "MpscQueue.h"
 
 namespace tx
 {
@@ -13,6 +19,48 @@ namespace tx
 class Context;
 class Entity;
 
+/**
+ *  The set of components a system reads and writes in update(). The context uses it to update
+ *  systems that do not conflict with each other concurrently.
+ *
+ *  Systems that did not declare their access are exclusive: they are never updated at the same
+ *  time as any other system. Only exclusive systems may make structural changes, i.e. add or
+ *  remove entities or components.
+ */
+struct ComponentAccess
+{
+    bool                     exclusive = true;
+    std::vector<ComponentID> reads;  ///< sorted
+    std::vector<ComponentID> writes; ///< sorted
+
+    /**
+     *  Tests whether two systems must not be updated at the same time, i.e. if one of them is
+     *  exclusive or writes a component the other one reads or writes.
+     */
+    bool conflictsWith(const ComponentAccess& other) const
+    {
+        return exclusive || other.exclusive || intersects(writes, other.writes) ||
+               intersects(writes, other.reads) || intersects(reads, other.writes);
+    }
+
+private:
+    static bool intersects(const std::vector<ComponentID>& a, const std::vector<ComponentID>& b)
+    {
+        auto itA = a.begin();
+        auto itB = b.begin();
+        while (itA != a.end() && itB != b.end())
+        {
+            if (*itA < *itB)
+                ++itA;
+            else if (*itB < *itA)
+                ++itB;
+            else
+                return true;
+        }
+        return false;
+    }
+};
+
 /**
  *  Polymorphic base class for Systems.
  *
@@ -28,17 +76,27 @@ public:
 
     /**
      *  [Threadsafe] Tests whether the system is interested in updates regarding a specific entity.
+     *  Only called for systems that did not subscribe to components with declareInterest().
      *
      *  By default, don't care about any entities.
      */
-    virtual bool isInterested(const Context&, const EntityID&, const ComponentID&) const
+    virtual bool isInterested(const Context&, EntityHandle, const ComponentID&) const
     {
         return false;
     };
 
+    /**
+     *  The components the system subscribed to with declareInterest(). If empty, the context
+     *  asks isInterested() about every component event instead.
+     */
+    const std::vector<ComponentID>& componentInterests() const { return interests_; }
+
     /**
      *  Tests whether the system is interested in events regarding a specific system [Threadsafe].
      *
+     *  The context asks once for every pair of systems when they are added and routes the events
+     *  accordingly, so the answer must not change afterwards.
+     *
      *  By default, don't care about any other systems.
      */
     virtual bool isInterested(const SystemID&) const { return false; };
@@ -71,78 +129,47 @@ public:
     /**
      *  [Threadsafe] Pushes an event to the system's event queue.
      *
-     *  We use a back-buffered queue to increase performance of this call:
-     *  While the front queue is blocked inside processEvents(), pushed events are enqueued in the
-     * back queue to prevent blocking other threads while processing long event lists.
+     *  The queue is lock-free, pushing never blocks, not even while the system is processing its
+     *  events.
      */
     void pushEvent(const Event& e)
     {
-        if (!frontQueueProcessing_) {
-            std::lock_guard<std::mutex> eqLock(eventQueueMutex_);
-            eventQueue_.push(e);
-        }
-        else
-        {
-            std::lock_guard<std::mutex> ebqLock(eventBackQueueMutex_);
-            backEventQueue_.push(e);
-        }
+        eventQueue_.push(e);
         setInvalid();
     };
 
     /**
-     *  [Threadsafe] Process all events in the event queue and clears the event queue.
+     *  [Threadsafe] Pushes the events [first, last) to the system's event queue at once.
+     */
+    void pushEvents(const Event* first, const Event* last)
+    {
+        eventQueue_.pushRange(first, last);
+        setInvalid();
+    }
+
+    /**
+     *  Process all events in the event queue and clears the event queue.
      *
-     *  Note that, due to multithreading, after this call the event queue is not
-     *  necessarily empty, as during the processing of the back queue other threads
-     *  might add events to the front queue again.
+     *  Only events pushed before this call are processed, events that are pushed concurrently
+     *  are left in the queue for the next call. Must not be called concurrently with itself or
+     *  clearEventQueue(), which the context guarantees as long as it is only called from
+     *  update().
      */
     template<typename FFn>
     void processEvents(FFn fn)
     {
-        { // Process all events from the main queue
-            SET_TEMPORARILY(frontQueueProcessing_, true);
-            std::lock_guard<std::mutex> eqLock(eventQueueMutex_);
-            while (!eventQueue_.empty())
-            {
-                fn(eventQueue_.front());
-                eventQueue_.pop();
-            }
-        }
-        { // Process all events from the back queue. This part will block potential pushEvent()
-          // calls until complete,
-            // but should be over rather fast
-            std::lock_guard<std::mutex> ebqLock(eventBackQueueMutex_);
-            while (!backEventQueue_.empty())
-            {
-                fn(backEventQueue_.front());
-                backEventQueue_.pop();
-            }
-        }
+        eventQueue_.consume([&fn](Event&& e) { fn(static_cast<const Event&>(e)); });
     }
 
     /**
-     *  [Threadsafe] Clears the event queue of the system.
+     *  Clears the event queue of the system.
      *
      *  Simply dequeues all events and discards them. Can be called as an
-     *  alternative to \a processEvents if they are not interesting.
+     *  alternative to \a processEvents if they are not interesting. The same restrictions apply.
      */
     void clearEventQueue()
     {
-        { // clear all events from the main queue
-            SET_TEMPORARILY(frontQueueProcessing_, true);
-            std::lock_guard<std::mutex> eqLock(eventQueueMutex_);
-            while (!eventQueue_.empty())
-            {
-                eventQueue_.pop();
-            }
-        }
-        { // clear all events from the back queue
-            std::lock_guard<std::mutex> ebqLock(eventBackQueueMutex_);
-            while (!backEventQueue_.empty())
-            {
-                backEventQueue_.pop();
-            }
-        }
+        eventQueue_.consume([](Event&&) {});
     }
 
     /**
@@ -160,17 +187,73 @@ public:
      */
     bool isValid() const { return valid_; }
 
+    /**
+     *  The components accessed in update(), see declareReads() and declareWrites().
+     */
+    const ComponentAccess& componentAccess() const { return access_; }
+
+    /**
+     *  The first change tick of the context after the last successful update() finished, 0
+     *  before the first one. Pass it to Context::eachChanged() to only visit the components
+     *  that were written since, not counting the writes of the system itself.
+     */
+    ChangeTick lastUpdateTick() const noexcept { return lastUpdateTick_; }
+
+protected:
+    /**
+     *  Declares components that are only read in update(). Has to be called in the constructor,
+     *  before the system is added to the context.
+     *
+     *  Once a system declares its access, it is no longer exclusive and will be updated
+     *  concurrently with all systems it does not conflict with.
+     */
+    void declareReads(std::initializer_list<ComponentID> cIds) { declare(access_.reads, cIds); }
+
+    /**
+     *  Declares components that are written in update(), see declareReads().
+     */
+    void declareWrites(std::initializer_list<ComponentID> cIds) { declare(access_.writes, cIds); }
+
+    /**
+     *  Subscribes to all events about the given components. Has to be called in the constructor,
+     *  before the system is added to the context.
+     *
+     *  The context routes the events of subscribed components directly to the system, without
+     *  calling isInterested(const Context&, ...) for every event.
+     */
+    template<typename IDs>
+    void declareInterest(const IDs& cIds)
+    {
+        interests_.insert(interests_.end(), std::begin(cIds), std::end(cIds));
+        std::sort(interests_.begin(), interests_.end());
+        interests_.erase(std::unique(interests_.begin(), interests_.end()), interests_.end());
+    }
+
+    void declareInterest(std::initializer_list<ComponentID> cIds)
+    {
+        declareInterest<std::initializer_list<ComponentID>>(cIds);
+    }
+
 private:
+    friend class Context;
+
+    void declare(std::vector<ComponentID>& set, std::initializer_list<ComponentID> cIds)
+    {
+        access_.exclusive = false;
+        set.insert(set.end(), cIds.begin(), cIds.end());
+        std::sort(set.begin(), set.end());
+        set.erase(std::unique(set.begin(), set.end()), set.end());
+    }
+
+    ComponentAccess          access_;    ///< components accessed by update()
+    std::vector<ComponentID> interests_; ///< components whose events the system subscribed to
+
     std::atomic<bool>
         valid_; ///< Flag to indicate whether the system is currently valid or if it needs to update()
 
-    // threadsafe event queue
-    std::atomic<bool>
-                      frontQueueProcessing_; ///< atomic indicating when the system is currently processing the front event queue
-    std::queue<Event> eventQueue_;
-    std::mutex        eventQueueMutex_;
-    std::queue<Event> backEventQueue_;
-    std::mutex        eventBackQueueMutex_;
+    MpscQueue<Event> eventQueue_; ///< lock-free, pushed to by any thread, consumed in update()
+
+    ChangeTick lastUpdateTick_ = 0; ///< set by the context after every successful update()
 };
 
 template<typename Derived>
@@ -184,9 +267,15 @@ public:
 
     static SystemID id()
     {
-        SystemID t(typeid(Derived));
-        t.id_[3] = typeid(Derived).hash_code();
-        return t;
+        // named after the system type, the last word is a hash of the full name to keep long
+        // names unique
+        static const SystemID sId = [] {
+            const std::string_view name = detail::typeName<Derived>();
+            SystemID               t(name);
+            t.id_[3] = std::hash<std::string_view>()(name);
+            return t;
+        }();
+        return sId;
     };
 };
 
@@ -210,11 +299,12 @@ public:
     AspectSpecificSystem(std::array<ComponentID, sizeof...(C)>&& cIds, bool valid = false)
         : System<AspectSpecificSystem<Aspect_<C...>>>(valid), aspect(std::move(cIds))
     {
+        this->declareInterest(aspect.ids_);
     }
 
     virtual ~AspectSpecificSystem() {}
 
-    virtual bool isInterested(const Context&, const EntityID& eId,
+    virtual bool isInterested(const Context&, EntityHandle entity,
                               const ComponentID& cId) const override;
 
 private:
@@ -230,11 +320,11 @@ namespace tx
 
 template<template<class...> class Aspect_, class... C>
 bool AspectSpecificSystem<Aspect_<C...>>::isInterested(const Context& /*c*/,
-                                                       const EntityID& /*eId*/,
+                                                       EntityHandle /*entity*/,
                                                        const ComponentID& cId) const
 {
     // TODO restore this check somehow
-    return aspect.isIDPartOf(cId) /* && aspect.checkAspect(c.getEntity(eId))*/;
+    return aspect.isIDPartOf(cId) /* && aspect.checkAspect(c.getEntity(entity))*/;
 }
 
 } // namespace tx
@@ -2,20 +2,28 @@
  * The ThreadPool class.
  * Keeps a set of threads constantly waiting to execute incoming jobs.
  * by "willp" http://roar11.com/2016/01/a-platform-independent-thread-pool-using-c14/
+ *
+ * Scheduling uses one work-stealing deque per worker: jobs submitted from a worker go to its own
+ * deque, jobs submitted from other threads go to a shared injection queue, and idle workers steal
+ * from each other before going to sleep.
  */
 #pragma once
 
 #ifndef THREADPOOL_H__
 #define THREADPOOL_H__
 
-#include "ThreadSafeWorkQueue.h"
+#include "WorkStealingDeque.h"
 
 #include <cstdint>
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <future>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <type_traits>
 #include <utility>
@@ -28,6 +36,10 @@ namespace tx
  * Specifically, this object will block and wait for execution to finish before going out of scope.
  * Use \a detach() if you do not care about the result and do not require waiting for it in the
  * destructor.
+ *
+ * A future can carry a helper function which is called repeatedly while waiting. The thread pool
+ * uses this to let waiting threads execute pending tasks instead of blocking, so that waiting for
+ * a task from inside another task cannot starve the pool.
  */
 template<typename T>
 class TaskFuture
@@ -36,6 +48,15 @@ public:
     // Non-explicit by design
     TaskFuture(std::future<T>&& future) : m_future{std::move(future)} {}
 
+    /**
+     * \param helper is called while waiting for the result. It should execute a pending unit
+     *      of work and return false if there was none.
+     */
+    TaskFuture(std::future<T>&& future, std::function<bool()> helper)
+        : m_future{std::move(future)}, m_helper{std::move(helper)}
+    {
+    }
+
     TaskFuture(const TaskFuture& rhs) = delete;
     TaskFuture& operator=(const TaskFuture& rhs) = delete;
     TaskFuture(TaskFuture&& other)               = default;
@@ -43,6 +64,15 @@ public:
     ~TaskFuture(void)
     {
         if (m_future.valid()) {
+            try
+            {
+                wait();
+            }
+            catch (...)
+            {
+                // the helper refused to wait on this thread, abandon the result like detach()
+                return;
+            }
             m_future.get();
         }
     }
@@ -58,6 +88,7 @@ public:
     auto get(void)
     {
         assert(m_future.valid());
+        wait();
         return m_future.get();
     }
 
@@ -69,7 +100,21 @@ public:
     void detach(void) { m_future = std::future<T>(); }
 
 private:
-    std::future<T> m_future;
+    /**
+     * Blocks until the result is available, running the helper as long as it finds work.
+     */
+    void wait(void)
+    {
+        while (m_helper &&
+               m_future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            if (!m_helper()) break;
+        }
+        m_future.wait();
+    }
+
+    std::future<T>        m_future;
+    std::function<bool()> m_helper;
 };
 
 class ThreadPool
@@ -95,7 +140,10 @@ private:
     class ThreadTask : public IThreadTask
     {
     public:
-        ThreadTask(Func&& func) : m_func{std::move(func)} {}
+        template<typename F>
+        ThreadTask(F&& func) : m_func{std::forward<F>(func)}
+        {
+        }
 
         ~ThreadTask(void) override        = default;
         ThreadTask(const ThreadTask& rhs) = delete;
@@ -128,13 +176,18 @@ public:
     /**
      * Constructor.
      */
-    explicit ThreadPool(const std::uint32_t numThreads) : m_done{false}, m_workQueue{}, m_threads{}
+    explicit ThreadPool(const std::uint32_t numThreads)
+        : m_done{false}, m_workerQueues{}, m_threads{}
     {
+        for (std::uint32_t i = 0u; i < numThreads; ++i)
+        {
+            m_workerQueues.emplace_back(std::make_unique<WorkStealingDeque<IThreadTask*>>());
+        }
         try
         {
             for (std::uint32_t i = 0u; i < numThreads; ++i)
             {
-                m_threads.emplace_back(&ThreadPool::worker, this);
+                m_threads.emplace_back(&ThreadPool::worker, this, i);
             }
         }
         catch (...)
@@ -171,66 +224,245 @@ public:
         using TaskType     = ThreadTask<PackagedTask>;
 
         PackagedTask           task{std::move(boundTask)};
-        TaskFuture<ResultType> result{task.get_future()};
-        m_workQueue.push(std::make_unique<TaskType>(std::move(task)));
+        TaskFuture<ResultType> result{makeTaskFuture(task.get_future())};
+        schedule(std::make_unique<TaskType>(std::move(task)));
         return result;
     }
 
+    /**
+     * Submit a job without a future to wait on. Cheaper than submit() for fire-and-forget work,
+     * the job must not throw.
+     */
+    template<typename Func>
+    void post(Func&& func)
+    {
+        schedule(std::make_unique<ThreadTask<std::decay_t<Func>>>(std::forward<Func>(func)));
+    }
+
+    /**
+     * Wraps a future that is fulfilled by tasks of this pool. Waiting on the returned TaskFuture
+     * executes pending tasks of the pool instead of blocking.
+     */
+    template<typename T>
+    TaskFuture<T> makeTaskFuture(std::future<T>&& future)
+    {
+        return TaskFuture<T>{std::move(future), [this]() { return runPendingTask(); }};
+    }
+
+    /**
+     * Executes one pending task on the calling thread, if there is any.
+     * Returns true if a task was executed.
+     */
+    bool runPendingTask(void)
+    {
+        const WorkerInfo&            self = currentWorker();
+        std::unique_ptr<IThreadTask> pTask{findTask(self.pool == this ? self.index : noWorker)};
+        if (!pTask) return false;
+        pTask->execute();
+        return true;
+    }
+
+    /**
+     * Number of worker threads.
+     */
+    std::size_t size(void) const { return m_threads.size(); }
+
 private:
+    /// identifies the worker running on the current thread, if any
+    struct WorkerInfo
+    {
+        ThreadPool* pool;
+        std::size_t index;
+    };
+
+    static constexpr std::size_t noWorker = static_cast<std::size_t>(-1);
+
+    /// number of unsuccessful searches for work before an idle worker goes to sleep
+    static constexpr int spinCount = 64;
+
+    /// maximum number of tasks a worker moves from the injection queue to its own deque at once
+    static constexpr std::size_t injectionBatchSize = 32;
+
+    static WorkerInfo& currentWorker(void)
+    {
+        static thread_local WorkerInfo info{nullptr, noWorker};
+        return info;
+    }
+
     /**
-     * Constantly running function each thread uses to acquire work items from the queue.
+     * Enqueues a task and wakes up a sleeping worker, if there is one.
      */
-    void worker(void)
+    void schedule(std::unique_ptr<IThreadTask> pTask)
     {
+        const WorkerInfo& self = currentWorker();
+        if (self.pool == this) {
+            m_workerQueues[self.index]->push(pTask.release());
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock{m_injectionMutex};
+            m_injectionQueue.push_back(pTask.release());
+            m_injectionSize.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Pairs with the sleep protocol in worker(): either the worker sees the new epoch before
+        // sleeping or we see the sleeping worker and wake it up.
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+            {
+                std::lock_guard<std::mutex> lock{m_sleepMutex};
+                ++m_wakeups;
+            }
+            m_sleepCondition.notify_one();
+        }
+    }
+
+    /**
+     * Finds a task, first in the deque of the given worker, then in the injection queue and then
+     * by stealing from the other workers. Returns nullptr if no task was found.
+     */
+    IThreadTask* findTask(std::size_t self)
+    {
+        IThreadTask* pTask = nullptr;
+        if (self != noWorker && m_workerQueues[self]->pop(pTask)) {
+            return pTask;
+        }
+
+        if (m_injectionSize.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock{m_injectionMutex};
+            if (!m_injectionQueue.empty()) {
+                // Workers take a batch to save on locking, the rest of it can be stolen
+                std::size_t count = 1;
+                if (self != noWorker) {
+                    count = std::min(m_injectionQueue.size(), injectionBatchSize);
+                    for (std::size_t i = 1; i < count; ++i)
+                        m_workerQueues[self]->push(m_injectionQueue[count - i]);
+                }
+                pTask = m_injectionQueue.front();
+                const auto first = m_injectionQueue.begin();
+                m_injectionQueue.erase(first, first + static_cast<std::ptrdiff_t>(count));
+                m_injectionSize.fetch_sub(count, std::memory_order_relaxed);
+                return pTask;
+            }
+        }
+
+        const std::size_t n     = m_workerQueues.size();
+        const std::size_t start = self == noWorker ? 0 : self + 1;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const std::size_t victim = (start + i) % n;
+            if (victim != self && m_workerQueues[victim]->steal(pTask)) {
+                return pTask;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Constantly running function each thread uses to acquire work items from the queues.
+     */
+    void worker(std::size_t index)
+    {
+        currentWorker() = WorkerInfo{this, index};
+
+        int idleRounds = 0;
         while (!m_done)
         {
-            std::unique_ptr<IThreadTask> pTask{nullptr};
-            if (m_workQueue.waitPop(pTask)) {
+            const std::uint64_t          epoch = m_epoch.load(std::memory_order_seq_cst);
+            std::unique_ptr<IThreadTask> pTask{findTask(index)};
+            if (pTask) {
                 pTask->execute();
+                idleRounds = 0;
+                continue;
+            }
+
+            if (++idleRounds < spinCount) {
+                std::this_thread::yield();
+                continue;
             }
+
+            // Nothing to do: announce that we are sleeping, then make sure nothing was scheduled
+            // since we last looked for work before waiting
+            std::unique_lock<std::mutex> lock{m_sleepMutex};
+            const std::uint64_t          wakeups = m_wakeups;
+            m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+            if (m_epoch.load(std::memory_order_seq_cst) == epoch) {
+                m_sleepCondition.wait(lock, [this, wakeups]() {
+                    return m_wakeups != wakeups || m_done;
+                });
+            }
+            m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+            idleRounds = 0;
         }
     }
 
     /**
-     * Invalidates the queue and joins all running threads.
+     * Wakes up and joins all running threads, then discards the tasks that did not run.
      */
     void destroy(void)
     {
-        m_done = true;
-        m_workQueue.invalidate();
+        {
+            std::lock_guard<std::mutex> lock{m_sleepMutex};
+            m_done = true;
+        }
+        m_sleepCondition.notify_all();
         for (auto& thread : m_threads)
         {
             if (thread.joinable()) {
                 thread.join();
             }
         }
+
+        IThreadTask* pTask = nullptr;
+        for (auto& queue : m_workerQueues)
+        {
+            while (queue->pop(pTask))
+            {
+                delete pTask;
+            }
+        }
+        for (IThreadTask* pending : m_injectionQueue)
+        {
+            delete pending;
+        }
+        m_injectionQueue.clear();
     }
 
 private:
-    std::atomic_bool                                  m_done;
-    ThreadSafeWorkQueue<std::unique_ptr<IThreadTask>> m_workQueue;
-    std::vector<std::thread>                          m_threads;
+    std::atomic_bool                                              m_done;
+    std::vector<std::unique_ptr<WorkStealingDeque<IThreadTask*>>> m_workerQueues;
+    std::vector<std::thread>                                      m_threads;
+
+    std::mutex               m_injectionMutex;
+    std::deque<IThreadTask*> m_injectionQueue; ///< tasks submitted from outside the pool
+    std::atomic<std::size_t> m_injectionSize{0};
+
+    std::mutex                 m_sleepMutex;
+    std::condition_variable    m_sleepCondition;
+    std::atomic<std::size_t>   m_sleeping{0}; ///< number of workers sleeping or about to
+    std::atomic<std::uint64_t> m_epoch{0};    ///< incremented for every scheduled task
+    std::uint64_t              m_wakeups{0};  ///< guarded by m_sleepMutex
 };
 
 namespace DefaultThreadPool
 {
 /**
- * Submit a job to the default thread pool.
+ * Get the default thread pool for the application.
+ * This pool is created with std::thread::hardware_concurrency() - 1 threads.
  */
-template<typename Func, typename... Args>
-inline auto submitJob(Func&& func, Args&&... args)
+inline ThreadPool& getThreadPool(void)
 {
-    return getThreadPool().submit(std::forward<Func>(func), std::forward<Args>(args)...);
+    static ThreadPool defaultPool;
+    return defaultPool;
 }
 
 /**
- * Get the default thread pool for the application.
- * This pool is created with std::thread::hardware_concurrency() - 1 threads.
+ * Submit a job to the default thread pool.
  */
-ThreadPool& getThreadPool(void)
+template<typename Func, typename... Args>
+inline auto submitJob(Func&& func, Args&&... args)
 {
-    static ThreadPool defaultPool;
-    return defaultPool;
+    return getThreadPool().submit(std::forward<Func>(func), std::forward<Args>(args)...);
 }
 }
 } // namespace tx
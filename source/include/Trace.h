@@ -0,0 +1,329 @@
+#pragma once
+
+/**
+ *	\file Trace.h
+ *	Structured, low overhead tracing of what the context does.
+ *
+ *	Trace points record fixed-size records into a ring buffer owned by the recording thread, so
+ *	recording never locks and never allocates. The most recent records of all threads can be
+ *	collected or dumped at any time from any thread.
+ *
+ *	TX_TRACE_LEVEL selects the trace points at compile time, all others compile to nothing:
+ *	 - 0: no tracing (default if NDEBUG is defined)
+ *	 - 1: system updates, each() dispatch and batches of events (default otherwise)
+ *	 - 2: additionally every single event
+ */
+
+#ifndef TX_TRACE_LEVEL
+#ifdef NDEBUG
+#define TX_TRACE_LEVEL 0
+#else
+#define TX_TRACE_LEVEL 1
+#endif
+#endif
+
+/// number of records kept per thread, has to be a power of two
+#ifndef TX_TRACE_CAPACITY
+#define TX_TRACE_CAPACITY 4096
+#endif
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Identifier.h"
+
+namespace tx
+{
+namespace trace
+{
+
+enum class Level : uint8_t
+{
+    Info    = 1,
+    Verbose = 2
+};
+
+enum class Category : uint8_t
+{
+    Event,
+    System,
+    Each
+};
+
+/**
+ *  A single trace record. The message has to be a string literal, a and b are values whose
+ *  meaning is given by the message.
+ */
+struct Record
+{
+    uint64_t    time;    ///< nanoseconds on the steady clock
+    uint32_t    thread;  ///< index of the recording thread's ring buffer
+    Level       level;
+    Category    category;
+    const char* message;
+    char        tag[Identifier::MAX_LENGTH]; ///< name of the related identifier, if any
+    uint64_t    a;
+    uint64_t    b;
+};
+
+/**
+ *  Ring buffer of trace records with a single writer, the owning thread, and any number of
+ *  concurrent readers. Every slot is guarded by a sequence number, readers skip slots that are
+ *  being overwritten while they read them.
+ */
+class Ring
+{
+public:
+    static constexpr uint64_t capacity = TX_TRACE_CAPACITY;
+    static_assert((capacity & (capacity - 1)) == 0, "TX_TRACE_CAPACITY must be a power of two");
+
+    explicit Ring(uint32_t index) : index_(index), slots_(new Slot[capacity]) {}
+
+    uint32_t index() const noexcept { return index_; }
+
+    /// appends a record, overwriting the oldest one if the buffer is full. Owner only.
+    void push(const Record& record) noexcept
+    {
+        const uint64_t i    = head_.load(std::memory_order_relaxed);
+        Slot&          slot = slots_[i & (capacity - 1)];
+        const uint64_t seq  = slot.seq.load(std::memory_order_relaxed);
+
+        // odd sequence numbers mark a slot as being written. The payload is stored with release
+        // semantics, so a reader that sees any of it also sees the odd sequence number.
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        uint64_t words[numWords];
+        pack(record, i, words);
+        for (size_t w = 0; w < numWords; ++w)
+            slot.words[w].store(words[w], std::memory_order_release);
+        slot.seq.store(seq + 2, std::memory_order_release);
+
+        head_.store(i + 1, std::memory_order_release);
+    }
+
+    /// appends all records that are still in the buffer and were not cleared. Any thread.
+    void collect(std::vector<Record>& out) const
+    {
+        const uint64_t head  = head_.load(std::memory_order_acquire);
+        const uint64_t begin = std::max(head > capacity ? head - capacity : 0,
+                                        cleared_.load(std::memory_order_relaxed));
+        for (uint64_t i = begin; i < head; ++i)
+        {
+            const Slot&    slot      = slots_[i & (capacity - 1)];
+            const uint64_t seqBefore = slot.seq.load(std::memory_order_acquire);
+            uint64_t       words[numWords];
+            for (size_t w = 0; w < numWords; ++w)
+                words[w] = slot.words[w].load(std::memory_order_acquire);
+            const uint64_t seqAfter = slot.seq.load(std::memory_order_relaxed);
+
+            // skip slots that were (being) overwritten by newer records
+            if (seqBefore % 2 != 0 || seqBefore != seqAfter || words[indexWord] != i) continue;
+            out.push_back(unpack(words));
+        }
+    }
+
+    /// drops all records recorded so far. Any thread.
+    void clear() noexcept { cleared_.store(head_.load(std::memory_order_acquire)); }
+
+    /// whether a thread currently records into this buffer, guarded by the registry
+    bool owned = false;
+
+private:
+    static constexpr size_t tagWords  = Identifier::MAX_LENGTH / sizeof(uint64_t);
+    static constexpr size_t indexWord = 0;
+    static constexpr size_t numWords  = 6 + tagWords;
+
+    struct Slot
+    {
+        std::atomic<uint64_t> seq{0};
+        std::atomic<uint64_t> words[numWords];
+    };
+
+    void pack(const Record& r, uint64_t i, uint64_t* words) const noexcept
+    {
+        words[indexWord] = i;
+        words[1]         = r.time;
+        words[2] = uint64_t(r.thread) << 16 | uint64_t(r.level) << 8 | uint64_t(r.category);
+        words[3] = reinterpret_cast<uint64_t>(r.message);
+        words[4] = r.a;
+        words[5] = r.b;
+        std::memcpy(&words[6], r.tag, sizeof(r.tag));
+    }
+
+    static Record unpack(const uint64_t* words) noexcept
+    {
+        Record r;
+        r.time     = words[1];
+        r.thread   = static_cast<uint32_t>(words[2] >> 16);
+        r.level    = static_cast<Level>((words[2] >> 8) & 0xff);
+        r.category = static_cast<Category>(words[2] & 0xff);
+        r.message  = reinterpret_cast<const char*>(words[3]);
+        r.a        = words[4];
+        r.b        = words[5];
+        std::memcpy(r.tag, &words[6], sizeof(r.tag));
+        return r;
+    }
+
+    const uint32_t          index_;
+    std::atomic<uint64_t>   head_{0};
+    std::atomic<uint64_t>   cleared_{0};
+    std::unique_ptr<Slot[]> slots_;
+};
+
+/**
+ *  Owns the ring buffers of all threads. Buffers of threads that exited are handed to new
+ *  threads, so the memory use is bounded by the maximum number of threads tracing at once.
+ */
+class Registry
+{
+public:
+    static Registry& instance()
+    {
+        // never destroyed, threads that outlive static destruction may still record or exit
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+
+    /// the ring buffer of the calling thread
+    Ring& local()
+    {
+        // returns the buffer to the registry when the thread exits
+        struct Handle
+        {
+            Ring* ring = nullptr;
+            ~Handle()
+            {
+                if (ring != nullptr) Registry::instance().release(*ring);
+            }
+        };
+        static thread_local Handle handle;
+        if (handle.ring == nullptr) handle.ring = &acquire();
+        return *handle.ring;
+    }
+
+    /// all records of all threads that were not cleared, ordered by time
+    std::vector<Record> collect() const
+    {
+        std::vector<Record>         records;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& ring : rings_)
+            ring->collect(records);
+        std::stable_sort(records.begin(), records.end(),
+                         [](const Record& a, const Record& b) { return a.time < b.time; });
+        return records;
+    }
+
+    /// drops all records recorded so far
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& ring : rings_)
+            ring->clear();
+    }
+
+private:
+    Ring& acquire()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& ring : rings_)
+        {
+            if (!ring->owned) {
+                ring->owned = true;
+                return *ring;
+            }
+        }
+        rings_.push_back(std::make_unique<Ring>(static_cast<uint32_t>(rings_.size())));
+        rings_.back()->owned = true;
+        return *rings_.back();
+    }
+
+    void release(Ring& ring)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ring.owned = false;
+    }
+
+    mutable std::mutex                 mutex_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+};
+
+/**
+ *  Records a trace record in the calling thread's ring buffer. Use the TX_TRACE_* macros
+ *  instead, so that trace points can be compiled out.
+ */
+template<typename T>
+void record(Level level, Category category, const char* message, const Identifier_<T>& tag,
+            uint64_t a = 0, uint64_t b = 0) noexcept
+{
+    Ring&  ring = Registry::instance().local();
+    Record r;
+    r.time     = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                       std::chrono::steady_clock::now().time_since_epoch())
+                                       .count());
+    r.thread   = ring.index();
+    r.level    = level;
+    r.category = category;
+    r.message  = message;
+    r.a        = a;
+    r.b        = b;
+    std::memcpy(r.tag, tag.id_.data(), sizeof(r.tag));
+    ring.push(r);
+}
+
+inline void record(Level level, Category category, const char* message, uint64_t a = 0,
+                   uint64_t b = 0) noexcept
+{
+    record(level, category, message, Identifier(), a, b);
+}
+
+/// all records of all threads that were not cleared, ordered by time
+inline std::vector<Record> collect() { return Registry::instance().collect(); }
+
+/// drops all records recorded so far
+inline void clear() { Registry::instance().clear(); }
+
+/// writes all records in a human readable form, one per line
+inline void dump(std::ostream& out)
+{
+    static const char* categories[] = {"event", "system", "each"};
+
+    const std::vector<Record> records = collect();
+    const uint64_t            start   = records.empty() ? 0 : records.front().time;
+    for (const auto& r : records)
+    {
+        out << "[" << std::setw(12) << std::fixed << std::setprecision(3)
+            << double(r.time - start) / 1000. << " us] T" << r.thread << " "
+            << categories[static_cast<int>(r.category)] << ": " << r.message;
+        if (r.tag[0] != '\0') {
+            out << " '" << std::string(r.tag, strnlen(r.tag, sizeof(r.tag))) << "'";
+        }
+        out << " (" << r.a << ", " << r.b << ")\n";
+    }
+}
+
+} // namespace trace
+} // namespace tx
+
+#if TX_TRACE_LEVEL >= 1
+/// records a trace record at info level: TX_TRACE_INFO(Category, "message", [tag,] [a, [b]])
+#define TX_TRACE_INFO(category, ...)                                                               \
+    ::tx::trace::record(::tx::trace::Level::Info, ::tx::trace::Category::category, __VA_ARGS__)
+#else
+#define TX_TRACE_INFO(category, ...) ((void)0)
+#endif
+
+#if TX_TRACE_LEVEL >= 2
+/// records a trace record at verbose level, see TX_TRACE_INFO
+#define TX_TRACE_VERBOSE(category, ...)                                                            \
+    ::tx::trace::record(::tx::trace::Level::Verbose, ::tx::trace::Category::category, __VA_ARGS__)
+#else
+#define TX_TRACE_VERBOSE(category, ...) ((void)0)
+#endif
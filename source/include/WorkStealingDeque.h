@@ -0,0 +1,174 @@
+/**
+ * The WorkStealingDeque class.
+ * Lock-free Chase-Lev deque: the owning thread pushes and pops at the bottom, any other thread
+ * can steal from the top. Implementation follows "Correct and Efficient Work-Stealing for Weak
+ * Memory Models" by Le, Pop, Cohen and Zappa Nardelli (PPoPP 2013), with the standalone fences
+ * replaced by sequentially consistent operations so that ThreadSanitizer can follow it.
+ */
+#pragma once
+
+#ifndef WORKSTEALINGDEQUE_H__
+#define WORKSTEALINGDEQUE_H__
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace tx
+{
+template<typename T>
+class WorkStealingDeque
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "WorkStealingDeque can only store trivially copyable types, e.g. pointers");
+
+    /**
+     * Circular buffer with a power-of-two capacity. Buffers are only replaced by bigger ones,
+     * never shrunk.
+     */
+    class Buffer
+    {
+    public:
+        explicit Buffer(std::int64_t capacity)
+            : m_capacity{capacity}, m_mask{capacity - 1}, m_data{new std::atomic<T>[capacity]}
+        {
+        }
+
+        std::int64_t capacity(void) const noexcept { return m_capacity; }
+
+        T get(std::int64_t i) const noexcept
+        {
+            return m_data[i & m_mask].load(std::memory_order_relaxed);
+        }
+
+        void put(std::int64_t i, T value) noexcept
+        {
+            m_data[i & m_mask].store(value, std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns a buffer of twice the size containing the elements [top, bottom)
+         */
+        Buffer* grow(std::int64_t bottom, std::int64_t top) const
+        {
+            Buffer* bigger = new Buffer{2 * m_capacity};
+            for (std::int64_t i = top; i != bottom; ++i)
+            {
+                bigger->put(i, get(i));
+            }
+            return bigger;
+        }
+
+    private:
+        std::int64_t                      m_capacity;
+        std::int64_t                      m_mask;
+        std::unique_ptr<std::atomic<T>[]> m_data;
+    };
+
+public:
+    /**
+     * Constructor. The capacity has to be a power of two.
+     */
+    explicit WorkStealingDeque(std::int64_t capacity = 1024)
+        : m_top{0}, m_bottom{0}, m_buffer{new Buffer{capacity}}
+    {
+    }
+
+    WorkStealingDeque(const WorkStealingDeque& rhs) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque& rhs) = delete;
+
+    /**
+     * Destructor.
+     */
+    ~WorkStealingDeque(void) { delete m_buffer.load(std::memory_order_relaxed); }
+
+    /**
+     * Push a value to the bottom. May only be called by the owning thread.
+     */
+    void push(T value)
+    {
+        std::int64_t b      = m_bottom.load(std::memory_order_relaxed);
+        std::int64_t t      = m_top.load(std::memory_order_acquire);
+        Buffer*      buffer = m_buffer.load(std::memory_order_relaxed);
+        if (b - t > buffer->capacity() - 1) {
+            // Full: thieves may still read from the old buffer, so it is retired, not deleted
+            Buffer* bigger = buffer->grow(b, t);
+            m_retired.emplace_back(buffer);
+            m_buffer.store(bigger, std::memory_order_release);
+            buffer = bigger;
+        }
+        buffer->put(b, value);
+        m_bottom.store(b + 1, std::memory_order_release);
+    }
+
+    /**
+     * Pop a value from the bottom. May only be called by the owning thread.
+     * Returns true if a value was successfully written to the out parameter, false otherwise.
+     */
+    bool pop(T& out)
+    {
+        std::int64_t b      = m_bottom.load(std::memory_order_relaxed) - 1;
+        Buffer*      buffer = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_seq_cst);
+        std::int64_t t = m_top.load(std::memory_order_seq_cst);
+
+        if (t > b) {
+            // empty
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        out = buffer->get(b);
+        if (t == b) {
+            // last element, race against concurrent steal() calls
+            bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                     std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    /**
+     * Steal a value from the top. Can be called by any thread.
+     * Returns true if a value was successfully written to the out parameter, false if the deque
+     * was empty or another thread won the race for the value.
+     */
+    bool steal(T& out)
+    {
+        std::int64_t t = m_top.load(std::memory_order_seq_cst);
+        std::int64_t b = m_bottom.load(std::memory_order_seq_cst);
+
+        if (t >= b) {
+            return false;
+        }
+
+        T value = m_buffer.load(std::memory_order_acquire)->get(t);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                           std::memory_order_relaxed)) {
+            return false;
+        }
+        out = value;
+        return true;
+    }
+
+    /**
+     * Check whether or not the deque is empty. The result is only a snapshot if other threads
+     * access the deque concurrently.
+     */
+    bool empty(void) const
+    {
+        return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+    }
+
+private:
+    alignas(64) std::atomic<std::int64_t> m_top;
+    alignas(64) std::atomic<std::int64_t> m_bottom;
+    alignas(64) std::atomic<Buffer*> m_buffer;
+    std::vector<std::unique_ptr<Buffer>> m_retired; ///< buffers replaced by push(), owner only
+};
+}
+
+#endif
@@ -173,8 +173,8 @@ static ResetAfterScope<U, V> setTemporarily(U& tgt, const V& value)
 /**
  *  Assertion function, based on inviwo assertion
  */
-void txAssertion(const char* fileName, const char* functionName, long lineNumber,
-                 const char* condition, const std::string& message)
+inline void txAssertion(const char* fileName, const char* functionName, long lineNumber,
+                        const char* condition, const std::string& message)
 {
     std::cout << "Assertion \"" << condition << "\" in (" << fileName << ", " << functionName
               << ", Ln " << lineNumber << "): ";